@@ -0,0 +1,80 @@
+#!/bin/sh
+#Runs the simulation over a matrix of inputs and thread counts and collects the throughput of every run.
+#
+#Usage: benchmark/run_benchmarks.sh [results directory]
+#
+#The matrix can be changed through these variables, each holding a list separated by spaces:
+#  CUSTOMERS, SELLERS, PRODUCTS, LIMITS (operation rights of a customer per day), WORKERS (pool sizes),
+#  DAYS, INSTANCES (instances of each product), REPEAT (runs of every combination) and EXTRA_OPTIONS.
+#ALIGNMENTS lists the cache line sizes the program is built with. The default 64 keeps the state of every thread on its
+#own cache line, ALIGNMENTS="64 8" also runs a build with that state packed together, to measure what the padding is worth.
+#WORKLOAD holds the lines of the workload section of the inputs separated by semicolons, for example
+#WORKLOAD="operations 60 30 10;products zipf 0.99".
+#The same SEED gives the same inputs and the same operations, so results of different versions can be compared.
+
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+RESULTS=${1:-"$ROOT/benchmark/results"}
+
+CUSTOMERS=${CUSTOMERS:-"1000 10000 100000"}
+SELLERS=${SELLERS:-"16 64"}
+PRODUCTS=${PRODUCTS:-"100 10000"}
+LIMITS=${LIMITS:-"10 100"}
+WORKERS=${WORKERS:-"1 2 4 8"}
+DAYS=${DAYS:-3}
+INSTANCES=${INSTANCES:-1000}
+REPEAT=${REPEAT:-3}
+SEED=${SEED:-1}
+EXTRA_OPTIONS=${EXTRA_OPTIONS:-""}
+WORKLOAD=${WORKLOAD:-""}
+ALIGNMENTS=${ALIGNMENTS:-64}
+
+mkdir -p "$RESULTS"
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+for alignment in $ALIGNMENTS; do
+    gcc -O2 -pthread -DCACHE_LINE_SIZE="$alignment" "$ROOT/main.c" -o "$WORK/shopping-service-$alignment" -lm
+done
+
+CSV="$RESULTS/results.csv"
+JSON="$RESULTS/results.json"
+rm -f "$CSV" "$JSON"
+
+for customers in $CUSTOMERS; do
+for sellers in $SELLERS; do
+for products in $PRODUCTS; do
+for limit in $LIMITS; do
+
+    #Every customer gets the same number of rights, so the amount of work only depends on the matrix.
+    awk -v c="$customers" -v s="$sellers" -v d="$DAYS" -v p="$products" -v n="$INSTANCES" -v l="$limit" -v seed="$SEED" -v w="$WORKLOAD" 'BEGIN{
+        srand(seed);
+        print c " Number of customers"; print s " Number of sellers"; print d " Number of simulation days"; print p " Number of products";
+        for(i = 0; i < p; i++) print int(n / 2 + rand() * n);
+        for(i = 1; i <= c; i++) print i " " l " " int(1 + rand() * 20);
+        if(w != ""){ print "workload"; count = split(w, lines, ";"); for(i = 1; i <= count; i++) print lines[i]; }
+    }' > "$WORK/input.txt"
+
+    for alignment in $ALIGNMENTS; do
+    for workers in $WORKERS; do
+    for run in $(seq "$REPEAT"); do
+
+        echo "customers=$customers sellers=$sellers products=$products limit=$limit alignment=$alignment workers=$workers run=$run"
+        (cd "$WORK" && "./shopping-service-$alignment" --fast-forward --pool="$workers" --report="$CSV" --seed="$SEED" $EXTRA_OPTIONS > /dev/null)
+    done
+    done
+    done
+done
+done
+done
+done
+
+#The same results as JSON, one object for each run.
+awk -F, 'NR == 1{ for(i = 1; i <= NF; i++) name[i] = $i; print "["; next }
+    { printf("%s  {", NR > 2 ? ",\n" : "");
+      for(i = 1; i <= NF; i++) printf("%s\"%s\": %s", i > 1 ? ", " : "", name[i], ($i ~ /^[0-9.]+$/) ? $i : "\"" $i "\"");
+      printf("}") }
+    END{ print "\n]" }' "$CSV" > "$JSON"
+
+echo "Results are written to $CSV and $JSON"
@@ -6,19 +6,44 @@
 #include <unistd.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <getopt.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <stdarg.h>
+#include <math.h>
+#include <linux/io_uring.h>
+#include <linux/mempolicy.h>
 
 //////////////////////////////////////////////////////// - GLOBAL VARIABLES
 //<editor-fold desc="GLOBAL VARIABLES">
 
-//Customer struct
+//Operation struct, one operation in the basket of a customer.
 typedef struct{
 
     int operation_type;
     int product_type;
     int product_amount;
 
+}operation_struct;
+
+//Customer struct
+typedef struct{
+
+    int basket_size;
+    int visit_day;
+    uint64_t request_time;
+
 }customer_struct;
 
+//A customer can bring at most this many operations to a seller in one visit.
+#define MAX_BASKET_SIZE 64
+
 //Reserve struct
 typedef struct reserve_struct_type{
 
@@ -27,640 +52,4762 @@ typedef struct reserve_struct_type{
     int product_amount;
     struct reserve_struct_type *next;
 
+    //The place of the reservation in the timer wheel, when reservations expire.
+    uint64_t expires_at;
+    struct reserve_struct_type *timer_next;
+    struct reserve_struct_type **timer_link;
+
 }reserve_struct;
 
-//Transaction struct
-typedef struct transaction_struct_type{
+#define RESERVE_SLAB_SIZE 4096
+
+//Reserve block struct, a block of reservations taken from the kernel at once.
+typedef struct reserve_block_type{
+
+    struct reserve_block_type *next;
+    reserve_struct nodes[RESERVE_SLAB_SIZE];
+
+}reserve_block;
+
+//Reserve slab struct, the reservations of one seller. Released reservations are kept in the free list and used
+//again, and nothing is given back to the kernel until the end of the run. Reservations never live longer than a day,
+//so the whole slab is reset at the day boundary.
+typedef struct{
+
+    reserve_struct *free_list;
+    reserve_block *first;
+    reserve_block *current;
+    int used;
+
+}reserve_slab_struct;
+
+//The input is mapped into memory one window at a time, so files larger than the memory can be read as well.
+#define INPUT_WINDOW_SIZE (64 * 1024 * 1024)
+
+//Input reader struct, a window of the input file mapped into memory.
+typedef struct{
+
+    int fd;
+    off_t file_size;
+    off_t window_offset;
+    size_t window_size;
+    char *window;
+    off_t position;
+    int line_no;
+
+}input_reader_struct;
+
+//Dirty list struct, the entities touched during a day. Only they need to be restored at the day boundary.
+typedef struct{
+
+    atomic_uchar *is_dirty;
+    int *entries;
+    atomic_int count;
+
+}dirty_list_struct;
+
+//Reserve list struct, the reservations of one customer in the order they were made.
+typedef struct{
+
+    reserve_struct *head;
+    reserve_struct *tail;
+
+}reserve_list_struct;
+
+//Customers share the reserve mutexes by their number, so different sellers rarely wait for each other.
+#define RESERVE_LOCK_STRIPES 64
+
+#define TIMER_WHEEL_SLOTS 256
+
+//Timer wheel struct, the reservations of one stripe by the time they expire. The first level has a slot for each of
+//the next 256 ticks, the second one for each of the next 256 blocks of 256 ticks. Anything further waits in the
+//overflow list. It is protected by the mutex of its stripe.
+typedef struct{
+
+    uint64_t now;
+    int count;
+    reserve_struct *ticks[TIMER_WHEEL_SLOTS];
+    reserve_struct *blocks[TIMER_WHEEL_SLOTS];
+    reserve_struct *overflow;
+
+}timer_wheel_struct;
+
+//Random struct, a PCG32 generator. Every customer has its own, so customers never wait for each other to draw a
+//number and the same seed gives every customer the same operations.
+typedef struct{
+
+    uint64_t state;
+    uint64_t increment;
+
+}random_struct;
+
+//Alias table struct, a discrete distribution which is sampled with two numbers. A column is picked evenly, then it is
+//kept with the chance in its threshold (out of 2^32), otherwise its alias is taken.
+typedef struct{
+
+    int size;
+    uint32_t *threshold;
+    int *alias;
+
+}alias_table_struct;
+
+//Workload struct, the distributions the customers draw their operations from. A table without any column keeps the
+//default: every operation type and product is as likely as the others, and amounts go from 1 to 5 evenly.
+typedef struct{
+
+    alias_table_struct operations;
+    alias_table_struct products;
+    alias_table_struct amounts;
+
+}workload_struct;
+
+#define MAX_WORKLOAD_AMOUNT 64
+
+//Transaction struct. The first transaction of a visit holds the number of transactions in the visit.
+typedef struct{
 
+    uint64_t sequence_no;
     int customer_no;
     int seller_no;
-    int operation_type;
+    int product_type;
     int product_amount;
     int simulation_day;
+    unsigned char operation_type;
+    unsigned char basket_size;
     bool is_successful;
-    struct transaction_struct_type *next;
 
-}transaction_struct;
+}transaction_struct;
+
+#define TRACE_MAGIC "SHOPTRC1"
+#define TRACE_END SIZE_MAX
+
+//Trace header struct, the start of a trace file. A trace can only be replayed with the input it was recorded with.
+typedef struct{
+
+    char magic[8];
+    uint32_t number_of_customers;
+    uint32_t number_of_products;
+    uint32_t number_of_simulation_days;
+    uint32_t reserved;
+
+}trace_header_struct;
+
+//Trace record struct, one operation a customer asked for. The first operation of a visit holds the number of
+//operations in the visit, the others hold zero.
+typedef struct{
+
+    uint32_t customer_no;
+    uint32_t product_type;
+    int32_t product_amount;
+    uint16_t simulation_day;
+    uint8_t operation_type;
+    uint8_t basket_size;
+
+}trace_record_struct;
+
+#define JOURNAL_MAGIC "SHOPJRN1"
+#define JOURNAL_COMMIT 0xFF
+#define JOURNAL_CHECKSUM_SEED 2166136261u
+
+//Journal header struct, the start of a journal file. The seed is kept, so a recovered run draws the operations the
+//stopped run would have drawn.
+typedef struct{
+
+    char magic[8];
+    uint32_t number_of_customers;
+    uint32_t number_of_sellers;
+    uint32_t number_of_products;
+    uint32_t number_of_simulation_days;
+    uint64_t random_seed;
+
+}journal_header_struct;
+
+//Journal record struct, one committed transaction. The amount of a cancellation is the amount given back. A group of
+//transactions ends with a commit record: its operation type is JOURNAL_COMMIT, the customer field holds the number of
+//transactions in the group, the product field their checksum, and the success field is set when the run is over.
+typedef struct{
+
+    uint32_t customer_no;
+    uint32_t product_type;
+    int32_t product_amount;
+    uint16_t seller_no;
+    uint16_t simulation_day;
+    uint8_t operation_type;
+    uint8_t is_successful;
+    uint8_t basket_size;
+    uint8_t reserved;
+
+}journal_record_struct;
+
+#define TRANSACTION_CHUNK_SIZE 4096
+
+//Transaction chunk struct, a contiguous block of transactions. The seller publishes a record by increasing the count,
+//so the writer thread can read it while the seller goes on.
+typedef struct transaction_chunk_type{
+
+    atomic_int count;
+    transaction_struct records[TRANSACTION_CHUNK_SIZE];
+    _Atomic(struct transaction_chunk_type *) next;
+
+}transaction_chunk;
+
+#define TRANSACTION_ARENA_SIZE 16
+
+//Transaction arena struct, chunks taken from the kernel at once.
+typedef struct transaction_arena_type{
+
+    struct transaction_arena_type *next;
+    int used;
+    transaction_chunk chunks[TRANSACTION_ARENA_SIZE];
+
+}transaction_arena;
+
+//Transaction log struct. Every seller appends only to its own log, so it needs no lock. The writer thread gives the
+//chunks it has written back through the written list and moves the head forward, and the seller fills them again.
+//The arenas are only unmapped at the end of the run.
+typedef struct{
+
+    _Atomic(transaction_chunk *) head;
+    transaction_chunk *tail;
+    _Atomic(transaction_chunk *) written;
+    transaction_chunk *spare;
+    transaction_arena *arena;
+
+}transaction_log_struct;
+
+//Transaction merge struct, used by the writer thread to read the logs of all sellers in sequence order. Sellers with
+//a published record wait in the heap, the others in the waiting list.
+typedef struct{
+
+    int *heap;
+    int heap_size;
+    int *waiting;
+    int waiting_count;
+    transaction_chunk **chunk;
+    int *position;
+    uint64_t next_sequence;
+
+}transaction_merge_struct;
+
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+
+//Ring struct, the submission and completion queues of io_uring which are shared with the kernel.
+typedef struct{
+
+    int fd;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring;
+    void *cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+}ring_struct;
+
+//Output struct, the buffered writer of "Output.txt". With io_uring the kernel writes one buffer while the other one
+//is being filled.
+typedef struct{
+
+    int fd;
+    off_t offset;
+    char *buffer[2];
+    int current;
+    size_t used;
+    bool use_ring;
+    bool write_pending;
+    size_t pending_size;
+    ring_struct ring;
+
+}output_struct;
+
+//Wait word struct, a futex word together with the number of threads sleeping on it.
+typedef struct{
+
+    atomic_int value;
+    atomic_int sleepers;
+
+}wait_word;
+
+//Wait modes
+enum{ WAIT_SPIN, WAIT_BLOCK, WAIT_ADAPTIVE };
+
+//Dispatch modes
+enum{ DISPATCH_TRYLOCK, DISPATCH_QUEUE };
+
+//Mailbox values other than a customer number.
+#define SELLER_IDLE -1
+#define SELLER_CLOSED -2
+
+//State written by different threads is kept on different cache lines. Building with -DCACHE_LINE_SIZE=8 packs it
+//together instead, which the benchmarks use to measure what the padding is worth.
+#ifndef CACHE_LINE_SIZE
+#define CACHE_LINE_SIZE 64
+#endif
+
+//Product struct. The stock and the sales of a product are kept on their own cache line, so sellers working on
+//different products do not slow each other down. The stock is kept once for each day bank. The last sale counter holds
+//the instances of expired reservations. The version counts the sellers updating the product in its low half and the
+//finished updates in its high half, so a snapshot reader can tell whether it read the product between two updates.
+//While a snapshot is taken, the changes made by visits which started after it are added up on the side, so the reader
+//can take them out again. In escrow mode, the number of sellers holding instances of the product is kept for each day
+//bank as well.
+typedef struct{
+
+    _Alignas(CACHE_LINE_SIZE) atomic_int num_of_instances[2];
+    atomic_int sales[4];
+    _Atomic uint64_t version;
+    atomic_int snapshot_stock[2];
+    atomic_int snapshot_sales[4];
+    atomic_int escrow_holders[2];
+
+}product_struct;
+
+//The snapshot generation of a seller which is not in a visit.
+#define SNAPSHOT_NO_VISIT UINT64_MAX
+
+//Changes of the product version when an update begins and ends, the second one also takes the seller out.
+#define PRODUCT_UPDATE_BEGIN 1ULL
+#define PRODUCT_UPDATE_END ((1ULL << 32) - 1)
+#define PRODUCT_UPDATERS(version) ((version) & 0xFFFFFFFFULL)
+
+//Inventory snapshot struct, the stock of the newest day and the sales of every product as they were at one point of
+//the run. Every visit of a seller is either wholly in it or not at all. The monitor thread is the only reader.
+typedef struct{
+
+    int simulation_day;
+    int *num_of_instances;
+    int (*sales)[4];
+    uint64_t retries;
+
+}inventory_snapshot_struct;
+
+//Shard struct, the counters of the transactions of each day and operation type that a seller keeps for itself.
+//Only the seller writes them, the main thread adds the shards up while the sellers are idle.
+typedef struct{
+
+    uint64_t *operations;
+    uint64_t *successful;
+
+}shard_struct;
+
+//Escrow struct, the instances of a product a seller holds for itself and the sales of the product it has not handed in
+//yet. Only the seller changes the sales. Other sellers take instances from the quota when the shared stock runs out.
+typedef struct{
+
+    atomic_int quota;
+    int sales[4];
+
+}escrow_struct;
+
+//Seller struct, the state of a seller. The mailbox and the mutex are used by the customers, the log and the slab by
+//the seller and the writer thread, and the snapshot generation of the current visit by the monitor thread, so each
+//part has its own cache line and no two sellers share one.
+typedef struct{
+
+    _Alignas(CACHE_LINE_SIZE) wait_word mailbox;
+    pthread_mutex_t mutex;
+    _Alignas(CACHE_LINE_SIZE) transaction_log_struct log;
+    shard_struct shard;
+    reserve_slab_struct slab[2];
+    escrow_struct *escrow[2];
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t visit_generation;
+
+}seller_struct;
+
+//Day bank struct, everything a day changes about the customers besides their random streams. Day N works on bank
+//N % 2, so the next day can start on the other bank while the visits of the last day finish. The main thread
+//restores a bank from the input image only after every visit of its day is over.
+typedef struct{
+
+    int index;
+    int *customer_rights;
+    int *customer_reserve_left;
+    bool *customer_status;
+    reserve_list_struct *reserve;
+    timer_wheel_struct *timer_wheels;
+    dirty_list_struct dirty_products;
+    dirty_list_struct dirty_customers;
+    _Alignas(CACHE_LINE_SIZE) wait_word requests_in_flight;
+
+}day_bank_struct;
+
+//Values below 16 nanoseconds have their own bucket, larger ones share 8 buckets for each power of two. This keeps
+//every value within 12.5 percent like a HDR histogram, up to about 39 hours.
+#define HISTOGRAM_BUCKETS (16 + 44 * 8)
+
+//Histogram struct, the distribution of a duration in nanoseconds.
+typedef struct{
+
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+
+}histogram_struct;
+
+//Metrics struct, the measurements of one seller or worker thread. Only its own thread writes into it, and it starts
+//on its own cache line, so measuring does not make threads slow each other down.
+typedef struct{
+
+    _Alignas(CACHE_LINE_SIZE) uint64_t operations[3];
+    uint64_t successful[3];
+    uint64_t stock_retries;
+    uint64_t escrow_refills;
+    uint64_t escrow_steals;
+    uint64_t reserve_contended;
+    uint64_t reserve_locked_at;
+    histogram_struct seller_wait;
+    histogram_struct latency[3];
+    histogram_struct reserve_wait;
+    histogram_struct reserve_hold;
+
+}metrics_struct;
+
+//Request cell struct, one slot of the request queue.
+typedef struct{
+
+    atomic_size_t sequence;
+    int customer_no;
+
+}request_cell;
+
+//Request queue struct, a bounded ring that all customers push into and all sellers pop from. In pool mode it holds
+//the customer tasks which are ready to run. Every customer is in it at most once, so it can never be full.
+typedef struct{
+
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t enqueue_position;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t dequeue_position;
+    _Alignas(CACHE_LINE_SIZE) wait_word pending;
+    request_cell *cells;
+    size_t mask;
+
+}request_queue_struct;
+
+//The highest bit of the pending count tells the sellers that no more requests will come.
+#define QUEUE_CLOSED (1 << 30)
+
+int number_of_customers;
+int number_of_sellers;
+int number_of_simulation_days;
+int number_of_products;
+
+atomic_int current_simulation_day;
+wait_word seller_released;
+
+//The day epoch is twice the current day while the day is open, and one more than that while it is being closed.
+wait_word day_epoch;
+wait_word day_over;
+
+bool fast_forward = false;
+uint64_t operations_per_day = 0;
+int day_length_ms = 1000;
+
+atomic_uint_fast64_t operations_today;
+atomic_int customers_done_today;
+
+int wait_mode = WAIT_ADAPTIVE;
+int dispatch_mode = DISPATCH_QUEUE;
+int adaptive_spin_limit = 2000;
+
+bool pool_mode = false;
+int number_of_workers;
+
+//The state of the customers is kept as separate arrays in the day banks, so a loop over one field reads only that field.
+day_bank_struct day_banks[2];
+struct timespec day_started;
+seller_struct *sellers;
+wait_word *customer_reply;
+request_queue_struct request_queue;
+request_queue_struct parked_queue;
+product_struct *products;
+
+//The state of the input file, parsed only once. Every day starts from this image.
+int *initial_num_of_instances;
+int *initial_customer_rights;
+int *initial_customer_reserve_left;
+int initial_customers_done;
+
+pthread_t *customer_ids;
+pthread_t *seller_ids;
+pthread_t *worker_ids;
+
+pthread_mutex_t reserve_mutex[RESERVE_LOCK_STRIPES];
+
+//When it is set, reservations expire after this many operations and their instances go back to the stock.
+int reservation_ttl = 0;
+
+customer_struct *customers;
+operation_struct *baskets;
+int basket_capacity = 1;
+bool all_or_nothing = false;
+random_struct *customer_random;
+workload_struct workload;
+uint64_t random_seed;
+bool seed_given = false;
+atomic_uint_fast64_t transaction_sequence;
+
+//Metrics are only collected when they are asked for. Every seller or worker writes into its own slot.
+bool metrics_enabled = false;
+char *metrics_file_name = NULL;
+FILE *metrics_file;
+metrics_struct *metrics;
+int number_of_metric_slots;
+_Thread_local metrics_struct *thread_metrics = NULL;
+
+//The day bank of the visit the thread is working on, and the slab and the escrow of that bank of the seller it works for.
+_Thread_local day_bank_struct *thread_bank = NULL;
+_Thread_local reserve_slab_struct *thread_slab = NULL;
+_Thread_local escrow_struct *thread_escrow = NULL;
+
+//When it is set, every seller sells from instances it holds for itself and takes this many more from the shared stock
+//whenever it runs out.
+int escrow_batch = 0;
+
+bool use_io_uring = false;
+output_struct output;
+pthread_t writer_id;
+atomic_bool writer_stop;
+uint64_t *transaction_of_customer;
+uint64_t *transaction_of_seller;
+long long transaction_of_operation[3];
+
+//When it is set, the transactions are only counted and Output.txt holds the summary sections alone.
+bool summary_only = false;
+
+//A trace holds the operations the customers asked for, so the same workload can be given to another build.
+char *record_file = NULL;
+FILE *trace_file = NULL;
+char *replay_file = NULL;
+void *trace_map;
+size_t trace_map_size;
+trace_record_struct *trace_records = NULL;
+size_t trace_length;
+size_t *trace_position;
+size_t *trace_next;
+int *trace_customers_of_day;
+
+//When a journal is given, the transactions are appended to it and made durable in groups, once every commit interval.
+//A run which stops halfway goes on from the journal when it is started again with the same journal.
+char *journal_name = NULL;
+FILE *journal_file = NULL;
+int commit_interval_ms = 10;
+struct timespec last_commit;
+uint32_t journal_pending;
+uint32_t journal_checksum;
+int journal_visit_left;
+transaction_struct *recovered_transactions = NULL;
+size_t recovered_length;
+int recovered_day = -1;
+uint64_t recovered_operations;
+int recovered_customers_done;
+
+//When it is set, a monitor thread prints a snapshot of the inventory this often while the simulation is running.
+int monitor_interval_ms = 0;
+pthread_t monitor_id;
+atomic_bool monitor_stop;
+
+//Snapshots are taken in generations. While a snapshot is read its generation is odd, and the visits which started in
+//it keep their changes on the side.
+_Atomic uint64_t snapshot_generation;
+_Thread_local uint64_t thread_generation = 0;
+
+//Odd while the escrow of a finished day is handed in. A snapshot is not taken in the middle of it.
+atomic_uint settlement_version;
+
+//When a report file is given, the measurements of the run are appended to it as a CSV line.
+char *report_file = NULL;
+struct timespec simulation_start;
+struct timespec simulation_end;
+
+//</editor-fold>
+//////////////////////////////////////////////////////// - PROTOTYPES OF FUNCTIONS
+//<editor-fold desc="PROTOTYPES OF FUNCTIONS">
+
+void parse_arguments(int argc, char *argv[]);
+int parse_option_number(char *text, int minimum, char *description);
+void print_usage(char *program_name);
+
+void read_file();
+void read_from_file(input_reader_struct *reader);
+bool next_input_line(input_reader_struct *reader, char **line, char **line_end);
+void input_error(input_reader_struct *reader, char *message);
+void read_workload(input_reader_struct *reader);
+void load_initial_state();
+void create_necessary_variables();
+operation_struct *customer_basket(int customer_no);
+void *allocate_interleaved(size_t size);
+void free_interleaved(void *memory, size_t size);
+void *map_memory(size_t size);
+reserve_struct *allocate_reserve();
+void release_reserve(reserve_struct *node);
+void reset_reserve_slab(reserve_slab_struct *slab);
+void free_reserve_slab(reserve_slab_struct *slab);
+transaction_chunk *allocate_chunk(transaction_log_struct *log);
+void release_chunk(transaction_log_struct *log, transaction_chunk *chunk);
+
+void create_threads();
+void manage_threads();
+void join_threads();
+
+void *customer_thread(void *argument);
+void *seller_thread(void *argument);
+void *worker_thread(void *argument);
+void run_customer_task(int customer_no, int seller_no);
+void wake_parked_customers();
+void generate_operation(int customer_no);
+void seed_random(random_struct *generator, uint64_t seed, uint64_t stream);
+uint32_t next_random(random_struct *generator);
+int random_below(random_struct *generator, int bound);
+void create_alias_table(alias_table_struct *table, double *weights, int size);
+int sample_alias(alias_table_struct *table, random_struct *generator);
+void free_alias_table(alias_table_struct *table);
+int draw_operation_type(random_struct *generator);
+int draw_product_type(random_struct *generator);
+int draw_product_amount(random_struct *generator);
+
+void wait_while_equal(wait_word *word, int value);
+void wake_waiters(wait_word *word, int count);
+void post_to_seller(int seller_no, int customer_no);
+void wait_for_seller(int seller_no, int customer_no);
+int wait_for_customer(int seller_no);
+void reply_to_customer(int seller_no);
+void wait_for_idle_seller(int seller_no);
+void wait_for_idle_sellers(day_bank_struct *bank);
+void release_seller();
+void close_sellers();
+
+void create_request_queue(request_queue_struct *queue, int capacity);
+void push_to_queue(request_queue_struct *queue, int customer_no);
+int pop_from_queue(request_queue_struct *queue);
+void close_queue(request_queue_struct *queue);
+void push_request(int customer_no);
+void wait_for_reply(int customer_no);
+void reply_to_request(int customer_no);
+
+int begin_visit(int customer_no);
+void end_visit();
+void count_operations(int customer_no, int count);
+void wait_for_end_of_day();
+void close_day();
+void open_day();
+void mark_dirty(dirty_list_struct *list, int index);
+void reset_day_state(day_bank_struct *bank);
+void create_day_bank(day_bank_struct *bank, int index);
+void free_day_bank(day_bank_struct *bank);
+void print_day_totals(int simulation_day);
+
+void serve_customer(int customer_to_serve, int seller_no);
+void serve_each_operation(int customer_to_serve, operation_struct *basket, int basket_size, bool *is_successful);
+void serve_whole_basket(int customer_to_serve, operation_struct *basket, int basket_size, bool *is_successful);
+
+void create_metrics();
+uint64_t metrics_now();
+void record_duration(histogram_struct *histogram, uint64_t duration);
+void lock_reserve_stripe(pthread_mutex_t *mutex);
+void unlock_reserve_stripe(pthread_mutex_t *mutex);
+void dump_metrics(int simulation_day);
+void print_histogram(char *name, histogram_struct *histogram);
+
+transaction_struct create_transaction(int customer_to_serve, operation_struct *operation, int simulation_day, bool is_successful, int seller_no);
+reserve_struct *create_reserve(int customer_to_serve, operation_struct *operation);
+
+void add_to_transaction_list(transaction_struct *newTransactions, int count);
+bool take_from_stock(int product_type, int product_amount);
+void return_to_stock(int product_type, int product_amount);
+void begin_product_update(int product_type);
+void end_product_update(int product_type);
+void add_to_sales(int product_type, int operation_type, int product_amount);
+bool take_from_escrow(int product_type, int product_amount);
+void return_to_escrow(int product_type, int product_amount);
+void settle_escrow(day_bank_struct *bank);
+void add_to_reserve_list(reserve_struct *newReserve);
+int cancel_reservation(int customer_to_serve, operation_struct *operation);
+bool take_reservations(int customer_to_serve, int count, reserve_struct **taken);
+void schedule_reservation(reserve_struct *node);
+void unschedule_reservation(reserve_struct *node);
+void advance_timer_wheel(timer_wheel_struct *wheel, uint64_t target);
+void sweep_reservations();
+void reset_timer_wheels(day_bank_struct *bank);
+uint64_t operation_clock();
+
+void begin_transaction_merge(transaction_merge_struct *merge);
+int write_ready_transactions(transaction_merge_struct *merge);
+void end_transaction_merge(transaction_merge_struct *merge);
+
+void start_writer();
+void stop_writer();
+void *writer_thread(void *argument);
+void count_from_shards();
+void open_trace();
+void record_transaction(transaction_struct *transaction);
+void close_trace();
+void load_trace();
+void replay_operation(int customer_no);
+bool trace_visits_left(int customer_no);
+void free_trace();
+
+void recover_journal();
+void open_journal();
+void journal_transaction(transaction_struct *transaction);
+void commit_journal(bool is_closing);
+void close_journal();
+
+void create_snapshot(inventory_snapshot_struct *snapshot);
+void take_snapshot(inventory_snapshot_struct *snapshot);
+void begin_snapshot_visit(int seller_no);
+void end_snapshot_visit(int seller_no);
+void free_snapshot(inventory_snapshot_struct *snapshot);
+void start_monitor();
+void stop_monitor();
+void *monitor_thread(void *argument);
+void print_snapshot(inventory_snapshot_struct *snapshot);
+void write_transaction(transaction_struct *transaction);
+void open_output();
+void output_format(const char *format, ...);
+void output_counts(const char *label, int number, const char *separator, uint64_t *counts, int count);
+void flush_output();
+void close_output();
+bool setup_ring(ring_struct *ring);
+void submit_write(ring_struct *ring, int fd, char *buffer, size_t size, off_t offset);
+int wait_for_write(ring_struct *ring);
+void close_ring(ring_struct *ring);
+
+void print_summary();
+void write_report();
+void clean_up();
+void clean_reserve_list_of(day_bank_struct *bank, int customer_no);
+void clean_transaction_list();
+
+//</editor-fold>
+//////////////////////////////////////////////////////// - MAIN METHOD
+
+int main(int argc, char *argv[]){
+
+    //Reading the command line options.
+    parse_arguments(argc, argv);
+
+    //Reading the input file.
+    read_file();
+    if(replay_file != NULL) load_trace();
+
+    //Creating necessary variables.
+    create_necessary_variables();
+
+    //The first day starts from the initial state, or from the state in the journal of a stopped run.
+    load_initial_state();
+    if(journal_name != NULL) recover_journal();
+
+    //The transactions are written into the output file while the simulation is running.
+    start_writer();
+
+    //Only the simulation itself is measured, reading the input is left out.
+    clock_gettime(CLOCK_MONOTONIC, &simulation_start);
+
+    if(metrics_enabled) create_metrics();
+
+    //Creating the threads.
+    create_threads();
+    if(monitor_interval_ms > 0) start_monitor();
+
+    //Managing threads;
+    manage_threads();
+
+    //When the job is done, we need to join all threads.
+    join_threads();
+    if(monitor_interval_ms > 0) stop_monitor();
+    clock_gettime(CLOCK_MONOTONIC, &simulation_end);
+    stop_writer();
+
+    //Printing the summary and cleaning up spaces allocated.
+    print_summary();
+    if(report_file != NULL) write_report();
+    clean_up();
+
+    return 0;
+}
+
+//////////////////////////////////////////////////////// - ARGUMENTS
+//<editor-fold desc="ARGUMENTS">
+
+void parse_arguments(int argc, char *argv[]){
+
+    static struct option long_options[] = {
+        {"wait",       required_argument, NULL, 'w'},
+        {"dispatch",   required_argument, NULL, 'd'},
+        {"pool",       optional_argument, NULL, 'p'},
+        {"fast-forward", optional_argument, NULL, 'f'},
+        {"day-length", required_argument, NULL, 'l'},
+        {"spin-limit", required_argument, NULL, 's'},
+        {"io-uring",   no_argument,       NULL, 'u'},
+        {"report",     required_argument, NULL, 'r'},
+        {"seed",       required_argument, NULL, 'S'},
+        {"metrics",    optional_argument, NULL, 'm'},
+        {"basket",     required_argument, NULL, 'b'},
+        {"all-or-nothing", no_argument,   NULL, 'a'},
+        {"reservation-ttl", required_argument, NULL, 't'},
+        {"summary-only", no_argument,     NULL, 'q'},
+        {"record",      required_argument, NULL, 'R'},
+        {"replay",      required_argument, NULL, 'P'},
+        {"monitor",     required_argument, NULL, 'M'},
+        {"journal",     required_argument, NULL, 'J'},
+        {"commit-interval", required_argument, NULL, 'C'},
+        {"escrow",      optional_argument, NULL, 'e'},
+        {"help",       no_argument,       NULL, 'h'},
+        {NULL, 0, NULL, 0}
+    };
+
+    int option;
+
+    while((option = getopt_long(argc, argv, "w:d:p::f::l:s:ur:S:m::b:at:qR:P:M:J:C:e::h", long_options, NULL)) != -1){
+
+        switch(option){
+            case 'w':
+                if(strcmp(optarg, "spin") == 0) wait_mode = WAIT_SPIN;
+                else if(strcmp(optarg, "block") == 0) wait_mode = WAIT_BLOCK;
+                else if(strcmp(optarg, "adaptive") == 0) wait_mode = WAIT_ADAPTIVE;
+                else{
+                    fprintf(stderr, "Error: unknown wait mode \"%s\"\n", optarg);
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'd':
+                if(strcmp(optarg, "trylock") == 0) dispatch_mode = DISPATCH_TRYLOCK;
+                else if(strcmp(optarg, "queue") == 0) dispatch_mode = DISPATCH_QUEUE;
+                else{
+                    fprintf(stderr, "Error: unknown dispatch mode \"%s\"\n", optarg);
+                    print_usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'p':
+                pool_mode = true;
+                if(optarg != NULL) number_of_workers = parse_option_number(optarg, 1, "number of workers");
+                break;
+            case 'f':
+                fast_forward = true;
+                if(optarg != NULL) operations_per_day = strtoull(optarg, NULL, 10);
+                break;
+            case 'l':
+                day_length_ms = (int) strtol(optarg, NULL, 10);
+                break;
+            case 's':
+                adaptive_spin_limit = parse_option_number(optarg, 0, "spin limit");
+                break;
+            case 'u':
+                use_io_uring = true;
+                break;
+            case 'r':
+                report_file = optarg;
+                break;
+            case 'S':
+                random_seed = strtoull(optarg, NULL, 10);
+                seed_given = true;
+                break;
+            case 'm':
+                metrics_enabled = true;
+                metrics_file_name = optarg;
+                break;
+            case 'b':
+                basket_capacity = (int) strtol(optarg, NULL, 10);
+                if(basket_capacity < 1 || basket_capacity > MAX_BASKET_SIZE){
+                    fprintf(stderr, "Error: basket size must be between 1 and %d\n", MAX_BASKET_SIZE);
+                    exit(1);
+                }
+                break;
+            case 'a':
+                all_or_nothing = true;
+                break;
+            case 't':
+                reservation_ttl = parse_option_number(optarg, 0, "reservation TTL");
+                break;
+            case 'q':
+                summary_only = true;
+                break;
+            case 'R':
+                record_file = optarg;
+                break;
+            case 'P':
+                replay_file = optarg;
+                break;
+            case 'M':
+                monitor_interval_ms = (int) strtol(optarg, NULL, 10);
+                if(monitor_interval_ms < 1){
+                    fprintf(stderr, "Error: monitor interval must be at least 1 millisecond\n");
+                    exit(1);
+                }
+                break;
+            case 'J':
+                journal_name = optarg;
+                break;
+            case 'C':
+                commit_interval_ms = (int) strtol(optarg, NULL, 10);
+                if(commit_interval_ms < 0){
+                    fprintf(stderr, "Error: commit interval can not be negative\n");
+                    exit(1);
+                }
+                break;
+            case 'e':
+                escrow_batch = (optarg != NULL) ? (int) strtol(optarg, NULL, 10) : 16;
+                if(escrow_batch < 1){
+                    fprintf(stderr, "Error: escrow batch must be at least 1\n");
+                    exit(1);
+                }
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                exit(0);
+            default:
+                print_usage(argv[0]);
+                exit(1);
+        }
+    }
+
+    //Without a seed every run is different.
+    if(seed_given == false) random_seed = (uint64_t) time(NULL) ^ ((uint64_t) getpid() << 32);
+
+    //The trace is recorded from the transactions, which are not kept in summary-only mode.
+    if(record_file != NULL && summary_only){
+        fprintf(stderr, "Error: a trace can not be recorded in summary-only mode\n");
+        exit(1);
+    }
+
+    //Recovery rebuilds the state from the transactions and draws the operations from the seed of the journal. Expired
+    //reservations are not transactions, and a replay does not draw its operations.
+    if(journal_name != NULL && (summary_only || replay_file != NULL || reservation_ttl > 0)){
+        fprintf(stderr, "Error: a journal can not be kept in summary-only mode, in a replay or with a reservation TTL\n");
+        exit(1);
+    }
+
+    //A replay has no clock. A day ends when every customer has done its visits of the day, with any dispatch mode, on
+    //customer threads or on the pool.
+    if(replay_file != NULL){
+        fast_forward = true;
+        operations_per_day = 0;
+    }
+
+    //By default the pool has one worker for each processor.
+    if(pool_mode && number_of_workers <= 0) number_of_workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+    //Spinning can not help on a single processor since the thread we wait for can not run meanwhile.
+    if(wait_mode == WAIT_ADAPTIVE && sysconf(_SC_NPROCESSORS_ONLN) < 2) adaptive_spin_limit = 0;
+}
+
+int parse_option_number(char *text, int minimum, char *description){
+
+    char *end;
+    long value;
+
+    //The whole argument must be the number, "10x" is a typo and not 10.
+    errno = 0;
+    value = strtol(text, &end, 10);
+
+    if(end == text || *end != '\0' || errno == ERANGE || value > INT32_MAX){
+        fprintf(stderr, "Error: %s must be a number, found \"%s\"\n", description, text);
+        exit(1);
+    }
+
+    if(value < minimum){
+        fprintf(stderr, "Error: %s must be at least %d\n", description, minimum);
+        exit(1);
+    }
+
+    return (int) value;
+}
+
+void print_usage(char *program_name){
+
+    printf("Usage: %s [options]\n", program_name);
+    printf("  -w, --wait=MODE        spin, block or adaptive (default) waiting between customers and sellers\n");
+    printf("  -d, --dispatch=MODE    queue (default) for a shared request queue, trylock for customers scanning the sellers\n");
+    printf("  -p, --pool[=WORKERS]   run customers as tasks on a pool of workers (default one per processor)\n");
+    printf("  -f, --fast-forward[=OPS] end a day after OPS operations or when no customer has any right left\n");
+    printf("  -l, --day-length=MS    length of a simulation day in milliseconds when not fast forwarding (default 1000)\n");
+    printf("  -s, --spin-limit=N     number of spins before sleeping in adaptive mode (default 2000)\n");
+    printf("  -u, --io-uring         write the output file through io_uring, if the kernel supports it\n");
+    printf("  -r, --report=FILE      append the throughput of the run to FILE as a CSV line\n");
+    printf("  -S, --seed=N           seed of the random operations, the same seed gives the same operations\n");
+    printf("  -m, --metrics[=FILE]   print counters and latency histograms at the end of every day, into FILE if given\n");
+    printf("  -b, --basket=N         a customer brings up to N operations to a seller in one visit (default 1)\n");
+    printf("  -a, --all-or-nothing   the operations of a basket either all succeed or all fail\n");
+    printf("  -t, --reservation-ttl=OPS a reservation expires after OPS operations and its instances are sold again\n");
+    printf("  -q, --summary-only     do not keep or write the transactions, only the summary sections\n");
+    printf("  -R, --record=FILE      write the operations of the customers into FILE as a binary trace\n");
+    printf("  -P, --replay=FILE      run the operations of a recorded trace instead of random ones\n");
+    printf("  -M, --monitor=MS       print a snapshot of the stock and the sales every MS milliseconds during the run\n");
+    printf("  -J, --journal=FILE     append the transactions to FILE and go on from it if an earlier run stopped halfway\n");
+    printf("  -C, --commit-interval=MS make the journal durable every MS milliseconds (default 10)\n");
+    printf("  -e, --escrow[=BATCH]   sellers sell from instances of their own and take BATCH more when they run out (default 16)\n");
+    printf("  -h, --help             print this message\n");
+}
+
+//</editor-fold>
+//////////////////////////////////////////////////////// - READING OPERATIONS
+//<editor-fold desc="READING OPERATIONS">
+
+void read_file(){
+
+    input_reader_struct reader;
+    struct stat file_info;
+
+    reader.fd = open("input.txt", O_RDONLY);
+
+    if(reader.fd == -1 || fstat(reader.fd, &file_info) == -1){
+
+        printf("\"input.txt\" does not exist. Please make sure it exists before starting this program.\n");
+        exit(1);
+    }
+
+    reader.file_size = file_info.st_size;
+    reader.window_offset = 0;
+    reader.window_size = 0;
+    reader.window = NULL;
+    reader.position = 0;
+    reader.line_no = 0;
+
+    read_from_file(&reader);
+
+    if(reader.window != NULL) munmap(reader.window, reader.window_size);
+    close(reader.fd);
+}
+
+static bool parse_number(char **cursor, char *end, int *value){
+
+    char *current = *cursor;
+    long number = 0;
+
+    while(current < end && (*current == ' ' || *current == '\t')) current++;
+
+    if(current == end || *current < '0' || *current > '9') return false;
+
+    while(current < end && *current >= '0' && *current <= '9'){
+
+        number = number * 10 + (*current - '0');
+        if(number > INT32_MAX) return false;
+
+        current++;
+    }
+
+    *cursor = current;
+    *value = (int) number;
+
+    return true;
+}
+
+//Nothing but blanks may follow the numbers of a line.
+static bool at_line_end(char *cursor, char *end){
+
+    while(cursor < end && (*cursor == ' ' || *cursor == '\t')) cursor++;
+
+    return cursor == end;
+}
+
+void read_from_file(input_reader_struct *reader){
+
+    char *line, *line_end;
+    char message[128];
+    int *header[4] = {&number_of_customers, &number_of_sellers, &number_of_simulation_days, &number_of_products};
+    int i, customer_id;
+
+    // We know that the first four line will contain the total number of some information.
+    for(i = 0; i < 4; i++){
+
+        if(next_input_line(reader, &line, &line_end) == false) input_error(reader, "the file ends before the four counts");
+        if(parse_number(&line, line_end, header[i]) == false || *header[i] <= 0) input_error(reader, "expected a positive count");
+    }
+
+    initial_num_of_instances = malloc(number_of_products * sizeof(int));
+    initial_customer_rights = malloc(number_of_customers * sizeof(int));
+    initial_customer_reserve_left = malloc(number_of_customers * sizeof(int));
+
+    if(initial_num_of_instances == NULL || initial_customer_rights == NULL || initial_customer_reserve_left == NULL){
+        fprintf(stderr, "Error: not enough memory for %d products and %d customers\n", number_of_products, number_of_customers);
+        exit(1);
+    }
+
+    //Now, we will loop by product count.
+    for(i = 0; i < number_of_products; i++){
+
+        if(next_input_line(reader, &line, &line_end) == false){
+            snprintf(message, sizeof(message), "expected %d product lines, found %d", number_of_products, i);
+            input_error(reader, message);
+        }
+
+        if(parse_number(&line, line_end, &initial_num_of_instances[i]) == false) input_error(reader, "expected the number of instances of a product");
+        if(at_line_end(line, line_end) == false) input_error(reader, "unexpected text after the number of instances of a product");
+    }
+
+    //And lastly, we need to fill in customers information.
+    for(i = 0; i < number_of_customers; i++){
+
+        if(next_input_line(reader, &line, &line_end) == false){
+            snprintf(message, sizeof(message), "expected %d customer lines, found %d", number_of_customers, i);
+            input_error(reader, message);
+        }
+
+        //The first number is the number of the customer, which must be the number of its line among the customers.
+        if(parse_number(&line, line_end, &customer_id) == false || parse_number(&line, line_end, &initial_customer_rights[i]) == false ||
+           parse_number(&line, line_end, &initial_customer_reserve_left[i]) == false)
+            input_error(reader, "expected three numbers for a customer");
+
+        if(at_line_end(line, line_end) == false) input_error(reader, "unexpected text after the three numbers of a customer");
+
+        if(customer_id != i + 1){
+            snprintf(message, sizeof(message), "expected customer %d, found customer %d", i + 1, customer_id);
+            input_error(reader, message);
+        }
+    }
+
+    //The customers may be followed by the workload section.
+    if(next_input_line(reader, &line, &line_end) == true){
+
+        //The whole line must be the keyword, "workloads" is not the start of the section.
+        if(line_end - line < 8 || strncmp(line, "workload", 8) != 0 || at_line_end(line + 8, line_end) == false)
+            input_error(reader, "unexpected line after the customers");
+
+        read_workload(reader);
+    }
+}
+
+void read_workload(input_reader_struct *reader){
+
+    char *line, *line_end;
+    char text[1024], *cursor, *end;
+    double weights[MAX_WORKLOAD_AMOUNT];
+    int count;
+
+    while(next_input_line(reader, &line, &line_end) == true){
+
+        if((size_t) (line_end - line) >= sizeof(text)) input_error(reader, "the workload line is too long");
+
+        memcpy(text, line, line_end - line);
+        text[line_end - line] = '\0';
+
+        //Every line starts with the name of a distribution, followed by its numbers.
+        char *name = strtok_r(text, " \t\r", &cursor);
+        if(name == NULL) continue;
+
+        if(strcmp(name, "operations") == 0 || strcmp(name, "amounts") == 0){
+
+            //Relative weights of BUY, RESERVE and CANCEL, or of the amounts 1, 2, 3 and so on.
+            int limit = (name[0] == 'o') ? 3 : MAX_WORKLOAD_AMOUNT;
+            double sum = 0;
+
+            for(count = 0; (name = strtok_r(NULL, " \t\r", &cursor)) != NULL; count++){
+
+                if(count == limit) input_error(reader, "too many weights");
+
+                weights[count] = strtod(name, &end);
+                if(*end != '\0' || weights[count] < 0) input_error(reader, "expected a weight which is not negative");
+                sum += weights[count];
+            }
+
+            if(sum <= 0 || (limit == 3 && count != 3)) input_error(reader, "expected weights which are not all zero, three of them for operations");
+
+            create_alias_table((limit == 3) ? &workload.operations : &workload.amounts, weights, count);
+            continue;
+        }
+
+        if(strcmp(name, "products") != 0) input_error(reader, "expected operations, products or amounts");
+
+        char *kind = strtok_r(NULL, " \t\r", &cursor);
+        char *first = strtok_r(NULL, " \t\r", &cursor);
+        char *second = strtok_r(NULL, " \t\r", &cursor);
+        double *popularity = malloc(number_of_products * sizeof(double));
+
+        if(kind != NULL && strcmp(kind, "zipf") == 0 && first != NULL && second == NULL){
+
+            //The product with rank k is chosen in proportion to 1 / k^s. The first product is the most popular one.
+            double exponent = strtod(first, &end);
+            if(*end != '\0' || exponent < 0) input_error(reader, "expected an exponent which is not negative");
+
+            for(int i = 0; i < number_of_products; i++) popularity[i] = pow(i + 1, -exponent);
+
+        }else if(kind != NULL && strcmp(kind, "hotspot") == 0 && first != NULL && second != NULL){
+
+            //The given percent of the products, the first ones, take the given percent of the operations.
+            double products_percent = strtod(first, &end);
+            if(*end != '\0' || products_percent <= 0 || products_percent > 100) input_error(reader, "expected a percent of products above 0");
+
+            double operations_percent = strtod(second, &end);
+            if(*end != '\0' || operations_percent < 0 || operations_percent > 100) input_error(reader, "expected a percent of operations");
+
+            int hot = (int) (number_of_products * products_percent / 100);
+            if(hot < 1) hot = 1;
+
+            //When every product is hot, there is no cold product to take the rest of the operations.
+            if(hot >= number_of_products && operations_percent != 100)
+                input_error(reader, "every product is hot, so the hot products must take 100 percent of the operations");
+
+            for(int i = 0; i < number_of_products; i++)
+                popularity[i] = (i < hot) ? operations_percent / hot : (100 - operations_percent) / (number_of_products - hot);
+
+        }else if(kind != NULL && strcmp(kind, "uniform") == 0 && first == NULL){
+
+            free(popularity);
+            continue;
+
+        }else input_error(reader, "expected products uniform, products zipf S or products hotspot P O");
+
+        create_alias_table(&workload.products, popularity, number_of_products);
+        free(popularity);
+    }
+}
+
+bool next_input_line(input_reader_struct *reader, char **line, char **line_end){
+
+    long page_size = sysconf(_SC_PAGESIZE);
+    char *start, *end, *newline;
+
+    while(reader->position < reader->file_size){
+
+        start = reader->window + (reader->position - reader->window_offset);
+        end = reader->window + reader->window_size;
+        newline = (reader->window != NULL) ? memchr(start, '\n', (size_t) (end - start)) : NULL;
+
+        //The line is not complete in this window. Unless the window already reaches the end of the file,
+        //we map a new one starting from the page of this line.
+        if(newline == NULL && reader->window_offset + (off_t) reader->window_size < reader->file_size){
+
+            off_t new_offset = reader->position - reader->position % page_size;
+
+            if(reader->window != NULL && new_offset == reader->window_offset) input_error(reader, "the line is too long");
+            if(reader->window != NULL) munmap(reader->window, reader->window_size);
+
+            reader->window_offset = new_offset;
+            reader->window_size = INPUT_WINDOW_SIZE;
+            if(reader->window_offset + (off_t) reader->window_size > reader->file_size)
+                reader->window_size = (size_t) (reader->file_size - reader->window_offset);
+
+            reader->window = mmap(NULL, reader->window_size, PROT_READ, MAP_PRIVATE, reader->fd, reader->window_offset);
+
+            if(reader->window == MAP_FAILED){
+                perror("Error: could not map \"input.txt\"");
+                exit(1);
+            }
+
+            madvise(reader->window, reader->window_size, MADV_SEQUENTIAL);
+            continue;
+        }
+
+        if(newline == NULL) newline = end;
+
+        reader->position += (newline - start) + 1;
+        reader->line_no++;
+
+        //Carriage returns are ignored and empty lines are skipped.
+        while(newline > start && (newline[-1] == '\r' || newline[-1] == ' ' || newline[-1] == '\t')) newline--;
+        if(newline == start) continue;
+
+        *line = start;
+        *line_end = newline;
+
+        return true;
+    }
+
+    return false;
+}
+
+void input_error(input_reader_struct *reader, char *message){
+
+    fprintf(stderr, "input.txt:%d: %s\n", reader->line_no, message);
+    exit(1);
+}
+
+//</editor-fold>
+//////////////////////////////////////////////////////// - THREADS
+//<editor-fold desc="THREADS">
+
+void create_threads(){
+
+    int i, thread_control;
+
+    //Creating mutexes.
+    for(i = 0; i < number_of_sellers; i++){
+
+        pthread_mutex_init(&sellers[i].mutex, NULL);
+    }
+
+    for(i = 0; i < RESERVE_LOCK_STRIPES; i++) pthread_mutex_init(&reserve_mutex[i], NULL);
+
+    if(pool_mode){
+
+        //Each worker acts as a group of sellers, so we can not have more workers than sellers.
+        if(number_of_workers > number_of_sellers) number_of_workers = number_of_sellers;
+
+        worker_ids = malloc(number_of_workers * sizeof(pthread_t));
+
+        //Every customer is a task which is ready to run at the beginning.
+        for(i = 0; i < number_of_customers; i++) push_to_queue(&request_queue, i);
+
+        //Creating worker threads.
+        for(i = 0; i < number_of_workers; i++){
+
+            thread_control = pthread_create(&worker_ids[i], NULL, &worker_thread, (void *)(intptr_t) i);
+
+            if(thread_control){
+                fprintf(stderr, "Error: return code from creating worker thread is %d\n", thread_control);
+                exit(-1);
+            }
+        }
+
+        return;
+    }
+
+    //First, we need to create the arrays which will hold ids.
+    customer_ids = malloc(number_of_customers * sizeof(pthread_t));
+    seller_ids = malloc(number_of_sellers * sizeof(pthread_t));
+
+    //Creating customer threads.
+    for(i = 0; i < number_of_customers; i++){
+
+        thread_control = pthread_create(&customer_ids[i], NULL, &customer_thread, (void *)(intptr_t) i);
+
+        if(thread_control){
+            fprintf(stderr, "Error: return code from creating customer thread is %d\n", thread_control);
+            exit(-1);
+        }
+    }
+
+    //Creating seller threads.
+    for(i = 0; i < number_of_sellers; i++){
+
+        thread_control = pthread_create(&seller_ids[i], NULL, &seller_thread, (void *)(intptr_t) i);
+
+        if(thread_control){
+            fprintf(stderr, "Error: return code from creating seller thread is %d\n", thread_control);
+            exit(-1);
+        }
+    }
+}
+
+void join_threads(){
+
+    int i, thread_control;
+
+    if(pool_mode){
+
+        //The simulation is over, so workers drop the remaining tasks and leave when the queue is empty.
+        close_queue(&request_queue);
+
+        for(i = 0; i < number_of_workers; i++){
+
+            thread_control = pthread_join(worker_ids[i], NULL);
+
+            if(thread_control){
+                fprintf(stderr, "Error: return code from joining the worker thread is %d\n", thread_control);
+                exit(-1);
+            }
+        }
+    }
+
+    for(i = 0; i < number_of_customers && pool_mode == false; i++){
+
+        thread_control = pthread_join(customer_ids[i], NULL);
+
+        if(thread_control){
+            fprintf(stderr, "Error: return code from joining the customer thread is %d\n", thread_control);
+            exit(-1);
+        }
+    }
+
+    //All customers are done, so no more requests can come. We can let the sellers go.
+    close_sellers();
+
+    for(i = 0; i < number_of_sellers && pool_mode == false; i++){
+
+        thread_control = pthread_join(seller_ids[i], NULL);
+
+        if(thread_control){
+            fprintf(stderr, "Error: return code from joining the seller thread is %d\n", thread_control);
+            exit(-1);
+        }
+    }
+
+    //Destroying mutexes.
+    for(i = 0; i < number_of_sellers; i++){
+
+        pthread_mutex_destroy(&sellers[i].mutex);
+    }
+
+    for(i = 0; i < RESERVE_LOCK_STRIPES; i++) pthread_mutex_destroy(&reserve_mutex[i]);
+}
+
+void manage_threads(){
+
+    int finished_day;
+
+    //All threads are created, the first day starts now.
+    open_day();
+
+    while(current_simulation_day < number_of_simulation_days){
+
+        //A day lasts either for the given time or, when fast forwarding, until enough operations are done.
+        wait_for_end_of_day();
+
+        //From now on, new visits wait at the day boundary.
+        close_day();
+        printf("Day %d ended.\n", current_simulation_day + 1);
+
+        //The bank of the next day was restored while this day was running, so everyone waiting at the boundary goes
+        //on with the next day right away, or leaves if the simulation is over.
+        finished_day = current_simulation_day;
+        current_simulation_day++;
+        open_day();
+
+        //The visits of the finished day may still be working on its bank. After they are over, nobody touches the
+        //bank again until the day after the next one.
+        wait_for_idle_sellers(&day_banks[finished_day % 2]);
+
+        //The instances and the sales the sellers kept for themselves during the finished day are handed in.
+        if(escrow_batch > 0) settle_escrow(&day_banks[finished_day % 2]);
+
+        //Customers which were parked for the rest of the finished day are ready to run again.
+        if(pool_mode) wake_parked_customers();
+
+        //Nobody is measuring anything for the finished day now, so its metrics can be read and cleared.
+        print_day_totals(finished_day);
+        if(metrics_enabled) dump_metrics(finished_day);
+
+        //The values touched during the day are reset back to original for the day after the next one.
+        //The reservations of those customers are cleared, as well.
+        if(finished_day + 2 < number_of_simulation_days) reset_day_state(&day_banks[finished_day % 2]);
+    }
+}
+
+void *customer_thread(void *argument){
+
+    int i = 0;
+    int status = -1;
+    int released;
+    int current_day;
+    int customer_no = (int)(intptr_t) argument;
+
+    //While the simulation days is not over...
+    while((current_day = begin_visit(customer_no)) != -1){
+
+        if(thread_bank->customer_status[customer_no] == false){
+
+            //If this is the case, this customer cannot do anything else until the current day finishes. So we need to suspend it.
+            end_visit();
+            wait_while_equal(&day_epoch, 2 * current_day);
+
+            continue;
+        }
+
+        //The customer decides what to do.
+        generate_operation(customer_no);
+
+        //The seller measures how long the customer has waited for it.
+        if(metrics_enabled) customers[customer_no].request_time = metrics_now();
+
+        if(dispatch_mode == DISPATCH_QUEUE){
+
+            //The request goes into the shared queue and the first idle seller takes it.
+            push_request(customer_no);
+
+            //We need to keep the customer waiting until its job finishes.
+            wait_for_reply(customer_no);
+
+            end_visit();
+            continue;
+        }
+
+        //Customer needs to find an empty seller. The day can not be reset while we are in a visit.
+        while(true){
+
+            //A seller released after this point changes the counter, so we do not sleep through it.
+            released = atomic_load(&seller_released.value);
+
+            for(i = 0; i < number_of_sellers; i++){
+
+                status = pthread_mutex_trylock(&sellers[i].mutex);
+
+                //If we able to lock anything which means we found an empty seller, we will exit the loop.
+                if(status != EBUSY)
+                    break;
+            }
+
+            if(status != EBUSY)
+                break;
+
+            //All sellers are busy. We wait for one of them to be released, the same way we wait for a handoff.
+            //A released seller wakes a single customer; if another customer takes it first, we come back here and sleep again.
+            wait_while_equal(&seller_released, released);
+        }
+
+        //Now, we need a way to communicate with the seller. So we put our request into its mailbox.
+        post_to_seller(i, customer_no);
+
+        //We need to keep the customer waiting until its job finishes.
+        wait_for_seller(i, customer_no);
+
+        end_visit();
+    }
+
+    pthread_exit(NULL);
+}
+
+void generate_operation(int customer_no){
+
+    random_struct *generator = &customer_random[customer_no];
+    operation_struct *basket = customer_basket(customer_no);
+
+    //A customer without any right left is turned away by the seller. It does not draw any number, so how many numbers
+    //a customer draws does not depend on when the day ends.
+    int basket_size = thread_bank->customer_rights[customer_no];
+    if(basket_size <= 0) return;
+
+    //A replayed customer takes its next visit from the trace instead.
+    if(trace_records != NULL){
+        replay_operation(customer_no);
+        return;
+    }
+
+    //The basket can not hold more operations than the customer has rights.
+    if(basket_size > basket_capacity) basket_size = basket_capacity;
+    customers[customer_no].basket_size = basket_size;
+
+    for(int i = 0; i < basket_size; i++){
+
+        //For each operation, we need another random number for the type of the operation. We have 3 different operations.
+        basket[i].operation_type = draw_operation_type(generator);
+
+        //Cancelling needs no product, it finds the one of the oldest reservation.
+        if(basket[i].operation_type != 2){ // BUY PRODUCT or RESERVE PRODUCT
+
+            basket[i].product_type = draw_product_type(generator);
+            basket[i].product_amount = draw_product_amount(generator);
+        }
+    }
+}
+
+void *seller_thread(void *argument){
+
+    int customer_to_serve;
+    int seller_no = (int)(intptr_t) argument;
+
+    //While the simulation is not over...
+    while(true){
+
+        if(dispatch_mode == DISPATCH_QUEUE){
+
+            //The seller takes the oldest request from the shared queue.
+            customer_to_serve = pop_from_queue(&request_queue);
+
+        }else{
+
+            //The seller waits for a customer to lock its mutex and put a request into its mailbox.
+            customer_to_serve = wait_for_customer(seller_no);
+        }
+
+        //No more requests can come when all customers are gone.
+        if(customer_to_serve == SELLER_CLOSED) break;
+
+        //Now, the seller can do a job.
+        serve_customer(customer_to_serve, seller_no);
+
+        if(dispatch_mode == DISPATCH_QUEUE){
+
+            //The customer is waiting on its own reply word.
+            reply_to_request(customer_to_serve);
+
+        }else{
+
+            //Since seller finished its job, we need to reset its status and wake the customer up.
+            reply_to_customer(seller_no);
+
+            //We will release the mutex, and wake one of the customers which found every seller busy.
+            pthread_mutex_unlock(&sellers[seller_no].mutex);
+            release_seller();
+        }
+    }
+
+    pthread_exit(NULL);
+}
+
+void *worker_thread(void *argument){
+
+    int customer_no;
+    int worker_no = (int)(intptr_t) argument;
+    int seller_no = worker_no;
+
+    //While the simulation is not over...
+    while(true){
+
+        //The worker takes the next customer task which is ready to run.
+        customer_no = pop_from_queue(&request_queue);
+
+        if(customer_no == SELLER_CLOSED) break;
+
+        //The worker acts as one of its sellers for this visit. Sellers are shared out between the workers,
+        //so a seller is never used by two workers at the same time.
+        run_customer_task(customer_no, seller_no);
+
+        seller_no += number_of_workers;
+        if(seller_no >= number_of_sellers) seller_no = worker_no;
+    }
+
+    pthread_exit(NULL);
+}
+
+void run_customer_task(int customer_no, int seller_no){
+
+    //The worker waits at the day boundary with this task. When the simulation is over, the task is finished.
+    if(begin_visit(customer_no) == -1) return;
+
+    if(thread_bank->customer_status[customer_no] == false){
+
+        //This customer cannot do anything else until the current day finishes, so it waits in the parked queue.
+        push_to_queue(&parked_queue, customer_no);
+        end_visit();
+
+        return;
+    }
+
+    //One step of the customer is one visit to a seller.
+    generate_operation(customer_no);
+    serve_customer(customer_no, seller_no);
+
+    //In pool mode, waiting for a seller means waiting in the queue for a free worker.
+    if(metrics_enabled) customers[customer_no].request_time = metrics_now();
+
+    push_to_queue(&request_queue, customer_no);
+    end_visit();
+}
+
+void wake_parked_customers(){
+
+    int customer_no;
+
+    //Only the main thread takes from the parked queue. A customer parked for the next day already is only woken
+    //early, it parks itself again.
+    while(atomic_load(&parked_queue.pending.value) > 0){
+
+        customer_no = pop_from_queue(&parked_queue);
+        push_to_queue(&request_queue, customer_no);
+    }
+}
+
+void serve_customer(int customer_to_serve, int seller_no){
+
+    uint64_t started_at = 0;
+    int day = customers[customer_to_serve].visit_day;
+
+    //The visit works on the bank of its own day, which may not be the current day any more.
+    thread_bank = &day_banks[day % 2];
+    thread_slab = &sellers[seller_no].slab[day % 2];
+    thread_escrow = sellers[seller_no].escrow[day % 2];
+
+    //Every bank has its own metric slots, so the metrics of a day can be read while the next day goes on. In pool
+    //mode the sellers of a worker are the ones with the same remainder.
+    if(metrics_enabled) thread_metrics = &metrics[(day % 2) * number_of_metric_slots + seller_no % number_of_metric_slots];
+
+    if(thread_metrics != NULL){
+
+        //Visits which started before the day began are not counted, since they have waited for the day as well.
+        started_at = metrics_now();
+        if(customers[customer_to_serve].request_time != 0) record_duration(&thread_metrics->seller_wait, started_at - customers[customer_to_serve].request_time);
+        customers[customer_to_serve].request_time = 0;
+    }
+
+    //Every visit changes something about the customer, it needs to be restored at the end of the day.
+    mark_dirty(&thread_bank->dirty_customers, customer_to_serve);
+
+    //Firstly, we need to check if that customer has any operation right.
+    if(thread_bank->customer_rights[customer_to_serve] <= 0){
+
+        //Means the customer has no right to do its job.
+        thread_bank->customer_status[customer_to_serve] = false;
+        return;
+    }
+
+    operation_struct *basket = customer_basket(customer_to_serve);
+    int basket_size = customers[customer_to_serve].basket_size;
+
+    //A replayed customer without any visit left in the trace is done for the day as well.
+    if(basket_size == 0){
+        thread_bank->customer_status[customer_to_serve] = false;
+        return;
+    }
+
+    bool is_successful[MAX_BASKET_SIZE];
+    transaction_struct records[MAX_BASKET_SIZE];
+
+    //Everything the visit changes in the inventory, the expired reservations included, belongs to one snapshot
+    //generation.
+    begin_snapshot_visit(seller_no);
+
+    if(all_or_nothing) serve_whole_basket(customer_to_serve, basket, basket_size, is_successful);
+    else serve_each_operation(customer_to_serve, basket, basket_size, is_successful);
+
+    //The transactions of the basket are added to the log together, in the order of the basket.
+    for(int i = 0; i < basket_size; i++)
+        records[i] = create_transaction(customer_to_serve, &basket[i], day, is_successful[i], seller_no);
+
+    records[0].basket_size = (unsigned char) basket_size;
+    add_to_transaction_list(records, basket_size);
+
+    if(reservation_ttl > 0) sweep_reservations();
+
+    end_snapshot_visit(seller_no);
+
+    //Every operation uses one of the customers rights, even if it fails.
+    thread_bank->customer_rights[customer_to_serve] -= basket_size;
+    count_operations(customer_to_serve, basket_size);
+
+    if(thread_metrics != NULL){
+
+        //A basket is measured as a whole, so every operation in it gets its share of the visit.
+        uint64_t duration = (metrics_now() - started_at) / basket_size;
+        for(int i = 0; i < basket_size; i++) record_duration(&thread_metrics->latency[basket[i].operation_type], duration);
+    }
+}
+
+//Sorts the purchases and reservations of the basket by product, so the stock of a product is updated once.
+static int group_by_product(operation_struct *basket, int basket_size, int *order){
+
+    int count = 0;
+
+    for(int i = 0; i < basket_size; i++){
+
+        if(basket[i].operation_type == 2) continue;
+
+        int j = count++;
+        while(j > 0 && basket[order[j - 1]].product_type > basket[i].product_type){
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    return count;
+}
+
+//Ends the updates of the products taken for a whole basket, once for each group of the same product.
+static void end_product_updates(operation_struct *basket, int *order, int count){
+
+    for(int k = 0; k < count; k++)
+        if(k == 0 || basket[order[k]].product_type != basket[order[k - 1]].product_type) end_product_update(basket[order[k]].product_type);
+}
+
+void serve_each_operation(int customer_to_serve, operation_struct *basket, int basket_size, bool *is_successful){
+
+    int order[MAX_BASKET_SIZE];
+    bool wanted[MAX_BASKET_SIZE];
+    int reserve_left = thread_bank->customer_reserve_left[customer_to_serve];
+
+    //We need to check if customers reserve amount is enough before taking anything from the stock. Reservations are
+    //checked in the order of the basket, as if the ones before them succeed.
+    for(int i = 0; i < basket_size; i++){
+
+        wanted[i] = true;
+        is_successful[i] = false;
+
+        if(basket[i].operation_type == 1){
+
+            if(reserve_left < basket[i].product_amount) wanted[i] = false;
+            else reserve_left -= basket[i].product_amount;
+        }
+    }
+
+    int count = group_by_product(basket, basket_size, order);
+
+    for(int first = 0, last; first < count; first = last){
+
+        int product_type = basket[order[first]].product_type;
+        int total = 0;
+
+        for(last = first; last < count && basket[order[last]].product_type == product_type; last++)
+            if(wanted[order[last]]) total += basket[order[last]].product_amount;
+
+        if(total == 0) continue;
+
+        //The stock and the sales of the product change together for a snapshot reader.
+        begin_product_update(product_type);
+
+        //Checking and decreasing the amount happens in one step, so two sellers can not sell the same instances.
+        //If the whole group does not fit, every operation tries on its own.
+        if(take_from_stock(product_type, total)){
+            for(int k = first; k < last; k++) is_successful[order[k]] = wanted[order[k]];
+        }else{
+            for(int k = first; k < last; k++)
+                is_successful[order[k]] = wanted[order[k]] && take_from_stock(product_type, basket[order[k]].product_amount);
+        }
+
+        for(int k = first; k < last; k++)
+            if(is_successful[order[k]]) add_to_sales(product_type, basket[order[k]].operation_type, basket[order[k]].product_amount);
+
+        end_product_update(product_type);
+    }
+
+    for(int i = 0; i < basket_size; i++){
+
+        if(is_successful[i] == false || basket[i].operation_type == 2) continue;
+
+        if(basket[i].operation_type == 1){
+
+            //Also, we need to add this to the reserve list and decrease from customers allowed reservation count.
+            add_to_reserve_list(create_reserve(customer_to_serve, &basket[i]));
+            thread_bank->customer_reserve_left[customer_to_serve] -= basket[i].product_amount;
+        }
+    }
+
+    //Cancellations come after the purchases and reservations of the basket.
+    for(int i = 0; i < basket_size; i++){
+
+        if(basket[i].operation_type != 2) continue;
+
+        int product_amount = cancel_reservation(customer_to_serve, &basket[i]);
+
+        if(product_amount == -1) continue;
+
+        //Cancelling found the product type and the amount of the reservation.
+        is_successful[i] = true;
+        basket[i].product_amount = product_amount;
+        begin_product_update(basket[i].product_type);
+        add_to_sales(basket[i].product_type, 2, product_amount);
+        return_to_stock(basket[i].product_type, product_amount);
+        end_product_update(basket[i].product_type);
+    }
+}
+
+void serve_whole_basket(int customer_to_serve, operation_struct *basket, int basket_size, bool *is_successful){
+
+    int order[MAX_BASKET_SIZE];
+    reserve_struct *cancelled[MAX_BASKET_SIZE];
+    int reserved = 0, cancels = 0, taken = 0;
+    bool is_done = true;
+
+    for(int i = 0; i < basket_size; i++){
+
+        if(basket[i].operation_type == 1) reserved += basket[i].product_amount;
+        if(basket[i].operation_type == 2) cancels++;
+    }
+
+    if(reserved > thread_bank->customer_reserve_left[customer_to_serve]) is_done = false;
+
+    int count = group_by_product(basket, basket_size, order);
+
+    //Every product is taken from the stock in one step. If one of them is missing, the ones taken are given back.
+    //A product stays in update until the end of the visit, so a snapshot sees it either before or after the basket.
+    for(int first = 0, last; first < count && is_done; first = last){
+
+        int product_type = basket[order[first]].product_type;
+        int total = 0;
+
+        for(last = first; last < count && basket[order[last]].product_type == product_type; last++) total += basket[order[last]].product_amount;
+
+        begin_product_update(product_type);
+
+        if(take_from_stock(product_type, total)) taken = last;
+        else{
+            end_product_update(product_type);
+            is_done = false;
+        }
+    }
+
+    //The reservations made before this visit must be enough for the cancellations of the basket.
+    if(is_done && cancels > 0 && take_reservations(customer_to_serve, cancels, cancelled) == false) is_done = false;
+
+    for(int i = 0; i < basket_size; i++) is_successful[i] = is_done;
+
+    if(is_done == false){
+
+        for(int k = 0; k < taken; k++) return_to_stock(basket[order[k]].product_type, basket[order[k]].product_amount);
+        end_product_updates(basket, order, taken);
+        return;
+    }
+
+    for(int i = 0, j = 0; i < basket_size; i++){
+
+        if(basket[i].operation_type == 2){
+
+            //Cancelling found the product type and the amount of the reservation.
+            basket[i].product_type = cancelled[j]->product_type;
+            basket[i].product_amount = cancelled[j]->product_amount;
+            begin_product_update(basket[i].product_type);
+            add_to_sales(basket[i].product_type, 2, cancelled[j]->product_amount);
+            return_to_stock(basket[i].product_type, cancelled[j]->product_amount);
+            end_product_update(basket[i].product_type);
+
+            release_reserve(cancelled[j++]);
+            continue;
+        }
+
+        add_to_sales(basket[i].product_type, basket[i].operation_type, basket[i].product_amount);
+
+        if(basket[i].operation_type == 1) add_to_reserve_list(create_reserve(customer_to_serve, &basket[i]));
+    }
+
+    end_product_updates(basket, order, taken);
+    thread_bank->customer_reserve_left[customer_to_serve] -= reserved;
+}
+
+//</editor-fold>
+//////////////////////////////////////////////////////// - WAITING OPERATIONS
+//<editor-fold desc="WAITING OPERATIONS">
+
+static inline void cpu_relax(){
+
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+void wait_while_equal(wait_word *word, int value){
+
+    //Spin mode never sleeps, adaptive mode spins for a while hoping that the handoff is short, block mode sleeps right away.
+    int spin_limit = (wait_mode == WAIT_SPIN) ? -1 : (wait_mode == WAIT_ADAPTIVE) ? adaptive_spin_limit : 0;
+
+    for(int i = 0; spin_limit < 0 || i < spin_limit; i++){
+
+        if(atomic_load_explicit(&word->value, memory_order_acquire) != value) return;
+        cpu_relax();
+    }
+
+    //The kernel checks the value again before sleeping, so a change between our check and the call is not lost.
+    while(atomic_load(&word->value) == value){
+
+        atomic_fetch_add(&word->sleepers, 1);
+        syscall(SYS_futex, &word->value, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+        atomic_fetch_sub(&word->sleepers, 1);
+    }
+}
+
+void wake_waiters(wait_word *word, int count){
+
+    //The value must be stored before calling this. If no one was counted as sleeping, no one can miss the change.
+    if(atomic_load(&word->sleepers) > 0)
+        syscall(SYS_futex, &word->value, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+void post_to_seller(int seller_no, int customer_no){
+
+    atomic_store(&sellers[seller_no].mailbox.value, customer_no);
+    wake_waiters(&sellers[seller_no].mailbox, INT32_MAX);
+}
+
+void wait_for_seller(int seller_no, int customer_no){
+
+    //The seller empties the mailbox when the job is done.
+    wait_while_equal(&sellers[seller_no].mailbox, customer_no);
+}
+
+int wait_for_customer(int seller_no){
+
+    wait_while_equal(&sellers[seller_no].mailbox, SELLER_IDLE);
+
+    return atomic_load(&sellers[seller_no].mailbox.value);
+}
+
+void reply_to_customer(int seller_no){
+
+    //Both the customer and the main thread may be waiting for this.
+    atomic_store(&sellers[seller_no].mailbox.value, SELLER_IDLE);
+    wake_waiters(&sellers[seller_no].mailbox, INT32_MAX);
+}
+
+void wait_for_idle_seller(int seller_no){
+
+    int customer_no;
+
+    while((customer_no = atomic_load(&sellers[seller_no].mailbox.value)) >= 0)
+        wait_while_equal(&sellers[seller_no].mailbox, customer_no);
+}
+
+void wait_for_idle_sellers(day_bank_struct *bank){
+
+    int in_flight;
+
+    //A visit is in flight from the moment the customer is admitted to the day until the seller replies to it.
+    while((in_flight = atomic_load(&bank->requests_in_flight.value)) != 0)
+        wait_while_equal(&bank->requests_in_flight, in_flight);
+}
+
+void release_seller(){
+
+    //Only one seller became free, so waking every waiting customer would only make all but one of them sleep again.
+    atomic_fetch_add(&seller_released.value, 1);
+    wake_waiters(&seller_released, 1);
+}
+
+void close_sellers(){
+
+    if(dispatch_mode == DISPATCH_QUEUE){
+
+        //Sellers still take the requests left in the queue, then they see the closed bit.
+        close_queue(&request_queue);
+
+        return;
+    }
+
+    for(int i = 0; i < number_of_sellers; i++){
+
+        wait_for_idle_seller(i);
+
+        atomic_store(&sellers[i].mailbox.value, SELLER_CLOSED);
+        wake_waiters(&sellers[i].mailbox, INT32_MAX);
+    }
+}
+
+//</editor-fold>
+//////////////////////////////////////////////////////// - REQUEST QUEUE
+//<editor-fold desc="REQUEST QUEUE">
+
+void create_request_queue(request_queue_struct *queue, int capacity){
+
+    //The ring size needs to be a power of two, so positions can be wrapped with a mask.
+    size_t size = 1;
+    while(size < (size_t) capacity) size <<= 1;
+
+    queue->cells = malloc(size * sizeof(request_cell));
+    queue->mask = size - 1;
+
+    for(size_t i = 0; i < size; i++) atomic_init(&queue->cells[i].sequence, i);
+
+    atomic_init(&queue->enqueue_position, 0);
+    atomic_init(&queue->dequeue_position, 0);
+    atomic_init(&queue->pending.value, 0);
+    atomic_init(&queue->pending.sleepers, 0);
+}
+
+static bool enqueue_request(request_queue_struct *queue, int customer_no){
+
+    request_cell *cell;
+    size_t position = atomic_load_explicit(&queue->enqueue_position, memory_order_relaxed);
+
+    while(true){
+
+        cell = &queue->cells[position & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) position;
+
+        //The cell is free for this position, we try to claim it.
+        if(difference == 0){
+            if(atomic_compare_exchange_weak_explicit(&queue->enqueue_position, &position, position + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        }else if(difference < 0){
+            return false;
+        }else{
+            position = atomic_load_explicit(&queue->enqueue_position, memory_order_relaxed);
+        }
+    }
+
+    cell->customer_no = customer_no;
+    atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+
+    return true;
+}
+
+static bool dequeue_request(request_queue_struct *queue, int *customer_no){
+
+    request_cell *cell;
+    size_t position = atomic_load_explicit(&queue->dequeue_position, memory_order_relaxed);
+
+    while(true){
+
+        cell = &queue->cells[position & queue->mask];
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) (position + 1);
+
+        //The cell holds a request for this position, we try to claim it.
+        if(difference == 0){
+            if(atomic_compare_exchange_weak_explicit(&queue->dequeue_position, &position, position + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        }else if(difference < 0){
+            return false;
+        }else{
+            position = atomic_load_explicit(&queue->dequeue_position, memory_order_relaxed);
+        }
+    }
+
+    *customer_no = cell->customer_no;
+    atomic_store_explicit(&cell->sequence, position + queue->mask + 1, memory_order_release);
+
+    return true;
+}
+
+void push_to_queue(request_queue_struct *queue, int customer_no){
+
+    //Every customer is in the queue at most once, so it is never really full. A seller may still be emptying the cell
+    //it has taken, so the ring can look full for a moment.
+    while(enqueue_request(queue, customer_no) == false) cpu_relax();
+
+    //The request is counted only after it is in the queue, so a seller that takes the count always finds a request.
+    atomic_fetch_add(&queue->pending.value, 1);
+    wake_waiters(&queue->pending, 1);
+}
+
+int pop_from_queue(request_queue_struct *queue){
+
+    int pending, customer_no;
+
+    while(true){
+
+        pending = atomic_load(&queue->pending.value);
+
+        //If there is a request, we take it from the count first, then from the ring.
+        if((pending & ~QUEUE_CLOSED) > 0){
+
+            if(atomic_compare_exchange_weak(&queue->pending.value, &pending, pending - 1)){
+
+                //Another customer may still be filling an earlier cell, so the ring can look empty for a moment.
+                while(dequeue_request(queue, &customer_no) == false) cpu_relax();
+
+                return customer_no;
+            }
+
+            continue;
+        }
+
+        if(pending & QUEUE_CLOSED) return SELLER_CLOSED;
+
+        wait_while_equal(&queue->pending, pending);
+    }
+}
+
+void close_queue(request_queue_struct *queue){
+
+    atomic_fetch_or(&queue->pending.value, QUEUE_CLOSED);
+    wake_waiters(&queue->pending, INT32_MAX);
+}
+
+void push_request(int customer_no){
+
+    atomic_store(&customer_reply[customer_no].value, 1);
+
+    push_to_queue(&request_queue, customer_no);
+}
+
+void wait_for_reply(int customer_no){
+
+    wait_while_equal(&customer_reply[customer_no], 1);
+}
+
+void reply_to_request(int customer_no){
+
+    atomic_store(&customer_reply[customer_no].value, 0);
+    wake_waiters(&customer_reply[customer_no], 1);
+}
+
+//</editor-fold>
+//////////////////////////////////////////////////////// - DAY OPERATIONS
+//<editor-fold desc="DAY OPERATIONS">
+
+int begin_visit(int customer_no){
+
+    int epoch;
+
+    while(true){
+
+        epoch = atomic_load(&day_epoch.value);
+
+        //The day is being closed, we wait for the next one.
+        if(epoch % 2 == 1){
+            wait_while_equal(&day_epoch, epoch);
+            continue;
+        }
+
+        if(epoch / 2 >= number_of_simulation_days) return -1;
+
+        //We count ourselves in the bank of the day first and check the epoch again. Either the main thread sees our
+        //count and waits for us before it restores the bank, or we see that the day is over.
+        thread_bank = &day_banks[(epoch / 2) % 2];
+        atomic_fetch_add(&thread_bank->requests_in_flight.value, 1);
+
+        if(atomic_load(&day_epoch.value) == epoch){
+            customers[customer_no].visit_day = epoch / 2;
+            return epoch / 2;
+        }
+
+        end_visit();
+    }
+}
+
+void end_visit(){
+
+    //The main thread may be waiting for all visits of the day to finish.
+    if(atomic_fetch_sub(&thread_bank->requests_in_flight.value, 1) == 1)
+        wake_waiters(&thread_bank->requests_in_flight, INT32_MAX);
+}
+
+void count_operations(int customer_no, int count){
+
+    if(fast_forward == false) return;
+
+    bool is_over = false;
+    int open_epoch = 2 * customers[customer_no].visit_day;
+
+    //A visit which finishes after its day is over does not count for the next day.
+    if(atomic_load(&day_epoch.value) != open_epoch) return;
+
+    //The visit which reaches the limit ends the day.
+    if(operations_per_day > 0){
+
+        uint64_t before = atomic_fetch_add_explicit(&operations_today, (uint64_t) count, memory_order_relaxed);
+        if(before < operations_per_day && before + count >= operations_per_day) is_over = true;
+    }
+
+    //A customer is done when it has no right left. A replayed customer is done after its last visit of the day in
+    //the trace, since the recorded day may have ended before its rights did.
+    bool is_done = thread_bank->customer_rights[customer_no] <= 0;
+    if(trace_records != NULL && trace_visits_left(customer_no) == false) is_done = true;
+
+    if(is_done && atomic_fetch_add_explicit(&customers_done_today, 1, memory_order_relaxed) + 1 == number_of_customers)
+        is_over = true;
+
+    //We close the day right away, so no more visits are admitted while the main thread wakes up. Only the day of
+    //the visit can be closed, and only once.
+    if(is_over && atomic_compare_exchange_strong(&day_epoch.value, &open_epoch, open_epoch + 1)){
+
+        atomic_store(&day_over.value, 1);
+        wake_waiters(&day_over, 1);
+    }
+}
+
+void wait_for_end_of_day(){
+
+    if(fast_forward == false){
+
+        //The day is measured from its opening, since the main thread finishes the last day in the meantime.
+        struct timespec day_end = day_started;
+
+        day_end.tv_sec += day_length_ms / 1000;
+        day_end.tv_nsec += (long) (day_length_ms % 1000) * 1000000L;
+
+        if(day_end.tv_nsec >= 1000000000L){
+            day_end.tv_sec++;
+            day_end.tv_nsec -= 1000000000L;
+        }
+
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &day_end, NULL) == EINTR);
+        return;
+    }
+
+    wait_while_equal(&day_over, 0);
+}
+
+void close_day(){
+
+    atomic_store(&day_epoch.value, 2 * current_simulation_day + 1);
+}
+
+void open_day(){
+
+    //Customers which start the day without any operation right are already done. In a replay, these are the ones
+    //without any visit in the trace on this day.
+    int customers_done = initial_customers_done;
+
+    uint64_t operations = 0;
+
+    if(trace_records != NULL && current_simulation_day < number_of_simulation_days)
+        customers_done = number_of_customers - trace_customers_of_day[current_simulation_day];
+
+    //A recovered day goes on from where the stopped run was.
+    if(current_simulation_day == recovered_day){
+        customers_done += recovered_customers_done;
+        operations = recovered_operations;
+    }
+
+    bool is_over = customers_done == number_of_customers || (operations_per_day > 0 && operations >= operations_per_day);
+
+    atomic_store(&operations_today, operations);
+    atomic_store(&customers_done_today, customers_done);
+    atomic_store(&day_over.value, is_over ? 1 : 0);
+    clock_gettime(CLOCK_MONOTONIC, &day_started);
+
+    atomic_store(&day_epoch.value, 2 * current_simulation_day);
+    wake_waiters(&day_epoch, INT32_MAX);
+}
+
+void load_initial_state(){
+
+    products = allocate_interleaved(number_of_products * sizeof(product_struct));
+
+    for(int i = 0; i < number_of_products; i++){
+        atomic_init(&products[i].num_of_instances[0], initial_num_of_instances[i]);
+        atomic_init(&products[i].num_of_instances[1], initial_num_of_instances[i]);
+    }
+
+    for(int i = 0; i < number_of_customers; i++) if(initial_customer_rights[i] <= 0) initial_customers_done++;
+
+    //Both banks start from the input, the second one is used by the second day.
+    create_day_bank(&day_banks[0], 0);
+    create_day_bank(&day_banks[1], 1);
+}
+
+void create_day_bank(day_bank_struct *bank, int index){
+
+    bank->index = index;
+
+    //All sellers touch the state of any customer, so it is spread over the memory of every processor.
+    bank->customer_rights = allocate_interleaved(number_of_customers * sizeof(int));
+    bank->customer_reserve_left = allocate_interleaved(number_of_customers * sizeof(int));
+    bank->customer_status = allocate_interleaved(number_of_customers * sizeof(bool));
+    bank->reserve = allocate_interleaved(number_of_customers * sizeof(reserve_list_struct));
+
+    memcpy(bank->customer_rights, initial_customer_rights, number_of_customers * sizeof(int));
+    memcpy(bank->customer_reserve_left, initial_customer_reserve_left, number_of_customers * sizeof(int));
+    memset(bank->customer_status, true, number_of_customers * sizeof(bool));
+
+    if(reservation_ttl > 0) bank->timer_wheels = calloc(RESERVE_LOCK_STRIPES, sizeof(timer_wheel_struct));
+
+    bank->dirty_products.is_dirty = calloc(number_of_products, sizeof(atomic_uchar));
+    bank->dirty_products.entries = malloc(number_of_products * sizeof(int));
+    bank->dirty_customers.is_dirty = calloc(number_of_customers, sizeof(atomic_uchar));
+    bank->dirty_customers.entries = malloc(number_of_customers * sizeof(int));
+}
+
+void free_day_bank(day_bank_struct *bank){
+
+    free_interleaved(bank->customer_rights, number_of_customers * sizeof(int));
+    free_interleaved(bank->customer_reserve_left, number_of_customers * sizeof(int));
+    free_interleaved(bank->customer_status, number_of_customers * sizeof(bool));
+    free_interleaved(bank->reserve, number_of_customers * sizeof(reserve_list_struct));
+    free(bank->timer_wheels);
+    free(bank->dirty_products.is_dirty);
+    free(bank->dirty_products.entries);
+    free(bank->dirty_customers.is_dirty);
+    free(bank->dirty_customers.entries);
+}
+
+void print_day_totals(int simulation_day){
+
+    uint64_t operations[3] = {0, 0, 0}, successful = 0;
+
+    //No visit of the day is left, so its counters in the shards can be read without any synchronization. The sellers
+    //only write the counters of the next day now.
+    for(int i = 0; i < number_of_sellers; i++){
+
+        for(int j = 0; j < 3; j++){
+
+            operations[j] += sellers[i].shard.operations[3 * simulation_day + j];
+            successful += sellers[i].shard.successful[3 * simulation_day + j];
+        }
+    }
+
+    printf("Day %d: %llu transactions, %llu successful (BUY %llu, RESERVE %llu, CANCEL %llu)\n", simulation_day + 1,
+           (unsigned long long) (operations[0] + operations[1] + operations[2]), (unsigned long long) successful,
+           (unsigned long long) operations[0], (unsigned long long) operations[1], (unsigned long long) operations[2]);
+}
+
+void mark_dirty(dirty_list_struct *list, int index){
+
+    //Only the first one to touch the entity during the day puts it into the list.
+    if(atomic_load_explicit(&list->is_dirty[index], memory_order_relaxed) == 0 &&
+       atomic_exchange_explicit(&list->is_dirty[index], 1, memory_order_relaxed) == 0)
+        list->entries[atomic_fetch_add_explicit(&list->count, 1, memory_order_relaxed)] = index;
+}
+
+void reset_day_state(day_bank_struct *bank){
+
+    int i, index;
+
+    //No visit of the day of this bank is in progress here, so we can restore everything without any synchronization.
+    if(reservation_ttl > 0) reset_timer_wheels(bank);
+
+    //Every reservation of the day is dropped, so the slabs start from their first block again.
+    for(i = 0; i < number_of_sellers; i++) reset_reserve_slab(&sellers[i].slab[bank->index]);
+
+    for(i = 0; i < bank->dirty_products.count; i++){
+
+        index = bank->dirty_products.entries[i];
+        atomic_store_explicit(&products[index].num_of_instances[bank->index], initial_num_of_instances[index], memory_order_relaxed);
+        atomic_store_explicit(&bank->dirty_products.is_dirty[index], 0, memory_order_relaxed);
+    }
+
+    for(i = 0; i < bank->dirty_customers.count; i++){
+
+        index = bank->dirty_customers.entries[i];
+        bank->customer_rights[index] = initial_customer_rights[index];
+        bank->customer_reserve_left[index] = initial_customer_reserve_left[index];
+        bank->customer_status[index] = true;
+        clean_reserve_list_of(bank, index);
+        atomic_store_explicit(&bank->dirty_customers.is_dirty[index], 0, memory_order_relaxed);
+    }
+
+    atomic_store(&bank->dirty_products.count, 0);
+    atomic_store(&bank->dirty_customers.count, 0);
+}
+
+//</editor-fold>
+//////////////////////////////////////////////////////// - METRICS
+//<editor-fold desc="METRICS">
+
+void create_metrics(){
+
+    //Sellers measure in thread mode and workers in pool mode.
+    number_of_metric_slots = pool_mode ? number_of_workers : number_of_sellers;
+
+    //One set of slots for each day bank.
+    size_t size = 2 * number_of_metric_slots * sizeof(metrics_struct);
+    metrics = aligned_alloc(CACHE_LINE_SIZE, size);
+    memset(metrics, 0, size);
+
+    if(metrics_file_name == NULL) metrics_file = stdout;
+    else metrics_file = fopen(metrics_file_name, "w");
+
+    if(metrics_file == NULL){
+        fprintf(stderr, "Error: \"%s\" could not be created: %s\n", metrics_file_name, strerror(errno));
+        exit(1);
+    }
+}
+
+uint64_t metrics_now(){
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+static int histogram_bucket(uint64_t value){
+
+    if(value < 16) return (int) value;
+
+    int magnitude = 63 - __builtin_clzll(value);
+    if(magnitude > 47) return HISTOGRAM_BUCKETS - 1;
+
+    return 16 + (magnitude - 4) * 8 + (int) ((value >> (magnitude - 3)) & 7);
+}
+
+static uint64_t histogram_value(int bucket){
+
+    if(bucket < 16) return (uint64_t) bucket;
+
+    int magnitude = (bucket - 16) / 8 + 4;
+
+    return (uint64_t) (8 + (bucket - 16) % 8) << (magnitude - 3);
+}
+
+void record_duration(histogram_struct *histogram, uint64_t duration){
+
+    histogram->count++;
+    histogram->sum += duration;
+    if(duration > histogram->max) histogram->max = duration;
+
+    histogram->buckets[histogram_bucket(duration)]++;
+}
+
+void lock_reserve_stripe(pthread_mutex_t *mutex){
+
+    if(thread_metrics == NULL){
+        pthread_mutex_lock(mutex);
+        return;
+    }
+
+    //Only a lock which is held by someone else is waited for.
+    uint64_t started_at = metrics_now();
+
+    if(pthread_mutex_trylock(mutex) == EBUSY){
+
+        thread_metrics->reserve_contended++;
+        pthread_mutex_lock(mutex);
+    }
+
+    thread_metrics->reserve_locked_at = metrics_now();
+    record_duration(&thread_metrics->reserve_wait, thread_metrics->reserve_locked_at - started_at);
+}
+
+void unlock_reserve_stripe(pthread_mutex_t *mutex){
+
+    if(thread_metrics != NULL) record_duration(&thread_metrics->reserve_hold, metrics_now() - thread_metrics->reserve_locked_at);
+
+    pthread_mutex_unlock(mutex);
+}
+
+static void merge_histogram(histogram_struct *total, histogram_struct *histogram){
+
+    total->count += histogram->count;
+    total->sum += histogram->sum;
+    if(histogram->max > total->max) total->max = histogram->max;
+
+    for(int i = 0; i < HISTOGRAM_BUCKETS; i++) total->buckets[i] += histogram->buckets[i];
+}
+
+static uint64_t histogram_percentile(histogram_struct *histogram, double percentile){
+
+    uint64_t target = (uint64_t) (histogram->count * percentile / 100.0);
+    uint64_t seen = 0;
+
+    for(int i = 0; i < HISTOGRAM_BUCKETS; i++){
+
+        seen += histogram->buckets[i];
+        if(seen > target) return histogram_value(i);
+    }
+
+    return histogram->max;
+}
+
+void print_histogram(char *name, histogram_struct *histogram){
+
+    if(histogram->count == 0){
+        fprintf(metrics_file, "%-22s count 0\n", name);
+        return;
+    }
+
+    fprintf(metrics_file, "%-22s count %llu\tmean %llu\tp50 %llu\tp90 %llu\tp99 %llu\tp99.9 %llu\tmax %llu\n", name,
+            (unsigned long long) histogram->count, (unsigned long long) (histogram->sum / histogram->count),
+            (unsigned long long) histogram_percentile(histogram, 50), (unsigned long long) histogram_percentile(histogram, 90),
+            (unsigned long long) histogram_percentile(histogram, 99), (unsigned long long) histogram_percentile(histogram, 99.9),
+            (unsigned long long) histogram->max);
+}
+
+void dump_metrics(int simulation_day){
+
+    static const char *operation_name[] = { "BUY", "RESERVE", "CANCEL" };
+    char name[32];
+
+    metrics_struct *total = calloc(1, sizeof(metrics_struct));
+
+    //The day was measured in the slots of its bank.
+    metrics_struct *slots = &metrics[(simulation_day % 2) * number_of_metric_slots];
+
+    for(int i = 0; i < number_of_metric_slots; i++){
+
+        for(int j = 0; j < 3; j++){
+
+            total->operations[j] += slots[i].operations[j];
+            total->successful[j] += slots[i].successful[j];
+            merge_histogram(&total->latency[j], &slots[i].latency[j]);
+        }
+
+        total->stock_retries += slots[i].stock_retries;
+        total->escrow_refills += slots[i].escrow_refills;
+        total->escrow_steals += slots[i].escrow_steals;
+        total->reserve_contended += slots[i].reserve_contended;
+        merge_histogram(&total->seller_wait, &slots[i].seller_wait);
+        merge_histogram(&total->reserve_wait, &slots[i].reserve_wait);
+        merge_histogram(&total->reserve_hold, &slots[i].reserve_hold);
+    }
+
+    fprintf(metrics_file, "\nMETRICS OF DAY %d (times in nanoseconds)\n\n", simulation_day + 1);
+
+    for(int j = 0; j < 3; j++){
+
+        fprintf(metrics_file, "%-8s %llu operations, %llu successful\n", operation_name[j],
+                (unsigned long long) total->operations[j], (unsigned long long) total->successful[j]);
+    }
+
+    fprintf(metrics_file, "Stock update retries: %llu\n", (unsigned long long) total->stock_retries);
+    if(escrow_batch > 0)
+        fprintf(metrics_file, "Escrow refills: %llu, steals: %llu\n", (unsigned long long) total->escrow_refills, (unsigned long long) total->escrow_steals);
+    fprintf(metrics_file, "Reserve lock contended: %llu\n\n", (unsigned long long) total->reserve_contended);
+
+    print_histogram("Waiting for a seller", &total->seller_wait);
+
+    for(int j = 0; j < 3; j++){
+
+        snprintf(name, sizeof(name), "%s latency", operation_name[j]);
+        print_histogram(name, &total->latency[j]);
+    }
+
+    print_histogram("Reserve lock wait", &total->reserve_wait);
+    print_histogram("Reserve lock hold", &total->reserve_hold);
+
+    //Every seller counts its own operations of each day in its shard, which is complete once the day is over.
+    fprintf(metrics_file, "\n");
+
+    for(int i = 0; i < number_of_sellers; i++){
+
+        uint64_t *operations = &sellers[i].shard.operations[3 * simulation_day];
+        fprintf(metrics_file, "Seller #%d - %llu operations\n", (i + 1), (unsigned long long) (operations[0] + operations[1] + operations[2]));
+    }
+
+    fflush(metrics_file);
+    free(total);
+
+    //Every day is measured on its own.
+    memset(slots, 0, number_of_metric_slots * sizeof(metrics_struct));
+}
+
+//</editor-fold>
+//////////////////////////////////////////////////////// - OTHER FUNCTIONS
+//<editor-fold desc="OTHER FUNCTIONS">
+
+operation_struct *customer_basket(int customer_no){
+
+    return &baskets[(size_t) customer_no * basket_capacity];
+}
+
+//Reads the highest node number from the list of online nodes, which looks like "0-3" or "0,2".
+static int number_of_nodes(){
+
+    char list[256];
+    int highest = 0;
+
+    FILE *fp = fopen("/sys/devices/system/node/online", "r");
+    if(fp == NULL) return 1;
+
+    if(fgets(list, sizeof(list), fp) != NULL){
+
+        for(char *cursor = list; *cursor != '\0';){
+
+            if(*cursor >= '0' && *cursor <= '9'){
+                int node = (int) strtol(cursor, &cursor, 10);
+                if(node > highest) highest = node;
+            }
+            else cursor++;
+        }
+    }
+
+    fclose(fp);
+
+    return highest + 1;
+}
+
+void *allocate_interleaved(size_t size){
+
+    if(size == 0) size = 1;
+
+    void *memory = map_memory(size);
+
+    //On a machine with more than one node, the pages are spread over all nodes before they are touched. Otherwise
+    //they would all end up on the node of the main thread. If this fails, the memory is still usable.
+    int nodes = number_of_nodes();
+
+    if(nodes > 1){
+
+        unsigned long mask[4] = {0};
+        for(int i = 0; i < nodes && i < 256; i++) mask[i / 64] |= 1UL << (i % 64);
+
+        syscall(__NR_mbind, memory, size, MPOL_INTERLEAVE, mask, 256, 0);
+    }
+
+    return memory;
+}
+
+void free_interleaved(void *memory, size_t size){
+
+    if(memory != NULL) munmap(memory, size == 0 ? 1 : size);
+}
+
+reserve_struct *allocate_reserve(){
+
+    reserve_slab_struct *slab = thread_slab;
+    reserve_struct *node = slab->free_list;
+
+    //Released reservations are used again first.
+    if(node != NULL){
+        slab->free_list = node->next;
+        return node;
+    }
+
+    if(slab->current == NULL || slab->used == RESERVE_SLAB_SIZE){
+
+        //After a day is reset, the blocks of the slab are used again from the first one.
+        reserve_block *block = (slab->current != NULL) ? slab->current->next : slab->first;
+
+        if(block == NULL){
+
+            block = map_memory(sizeof(reserve_block));
+            block->next = NULL;
+
+            if(slab->current == NULL) slab->first = block;
+            else slab->current->next = block;
+        }
+
+        slab->current = block;
+        slab->used = 0;
+    }
+
+    return &slab->current->nodes[slab->used++];
+}
+
+void release_reserve(reserve_struct *node){
+
+    //A reservation can go back to the slab of another seller than the one it came from. Every node stays valid
+    //until the day is over, so this does not matter.
+    node->next = thread_slab->free_list;
+    thread_slab->free_list = node;
+}
+
+void reset_reserve_slab(reserve_slab_struct *slab){
+
+    slab->free_list = NULL;
+    slab->current = NULL;
+    slab->used = 0;
+}
+
+void free_reserve_slab(reserve_slab_struct *slab){
+
+    reserve_block *block = slab->first;
+
+    while(block != NULL){
+
+        reserve_block *next = block->next;
+        munmap(block, sizeof(reserve_block));
+        block = next;
+    }
+
+    slab->first = NULL;
+    reset_reserve_slab(slab);
+}
+
+transaction_chunk *allocate_chunk(transaction_log_struct *log){
+
+    //The writer thread gives the chunks it has written back to the seller. We take all of them at once, so the
+    //list can not change under us while we use it.
+    if(log->spare == NULL) log->spare = atomic_exchange_explicit(&log->written, NULL, memory_order_acquire);
+
+    transaction_chunk *chunk = log->spare;
+
+    if(chunk != NULL){
+
+        log->spare = atomic_load_explicit(&chunk->next, memory_order_relaxed);
+
+    }else{
+
+        if(log->arena == NULL || log->arena->used == TRANSACTION_ARENA_SIZE){
+
+            transaction_arena *arena = map_memory(sizeof(transaction_arena));
+            arena->next = log->arena;
+            arena->used = 0;
+            log->arena = arena;
+        }
+
+        chunk = &log->arena->chunks[log->arena->used++];
+    }
+
+    atomic_store_explicit(&chunk->count, 0, memory_order_relaxed);
+    atomic_store_explicit(&chunk->next, NULL, memory_order_relaxed);
+
+    return chunk;
+}
+
+void release_chunk(transaction_log_struct *log, transaction_chunk *chunk){
+
+    transaction_chunk *head = atomic_load_explicit(&log->written, memory_order_relaxed);
+
+    //Only the writer thread pushes and the seller takes the whole list, so the exchange can only fail when the seller
+    //has just emptied it.
+    do{
+        atomic_store_explicit(&chunk->next, head, memory_order_relaxed);
+    }while(!atomic_compare_exchange_weak_explicit(&log->written, &head, chunk, memory_order_release, memory_order_relaxed));
+}
+
+void *map_memory(size_t size){
+
+    //The memory comes from the kernel directly, so it is zero and aligned to a page.
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if(memory == MAP_FAILED){
+        fprintf(stderr, "Error: not enough memory for %zu bytes\n", size);
+        exit(1);
+    }
+
+    return memory;
+}
+
+void create_necessary_variables(){
+
+    //All sellers touch the state of any customer, so it is spread over the memory of every processor.
+    customers = allocate_interleaved(number_of_customers * sizeof(customer_struct));
+    baskets = allocate_interleaved((size_t) number_of_customers * basket_capacity * sizeof(operation_struct));
+    customer_random = malloc(number_of_customers * sizeof(random_struct));
+
+    sellers = aligned_alloc(CACHE_LINE_SIZE, number_of_sellers * sizeof(seller_struct));
+    memset(sellers, 0, number_of_sellers * sizeof(seller_struct));
+
+    for(int i = 0; i < number_of_sellers; i++){
+
+        sellers[i].shard.operations = calloc(3 * (size_t) number_of_simulation_days, sizeof(uint64_t));
+        sellers[i].shard.successful = calloc(3 * (size_t) number_of_simulation_days, sizeof(uint64_t));
+
+        //The pages of the escrow are only touched by the seller, so they end up in its own memory.
+        if(escrow_batch > 0){
+            sellers[i].escrow[0] = map_memory(number_of_products * sizeof(escrow_struct));
+            sellers[i].escrow[1] = map_memory(number_of_products * sizeof(escrow_struct));
+        }
+    }
+    customer_reply = allocate_interleaved(number_of_customers * sizeof(wait_word));
+
+    if(dispatch_mode == DISPATCH_QUEUE || pool_mode) create_request_queue(&request_queue, number_of_customers);
+    if(pool_mode) create_request_queue(&parked_queue, number_of_customers);
+
+    //Every customer draws from its own stream of the same seed.
+    for(int i = 0; i < number_of_customers; i++) seed_random(&customer_random[i], random_seed, (uint64_t) i);
+
+    //Also we need to reset the mailboxes of the sellers;
+    for(int i = 0; i < number_of_sellers; i++){
+        atomic_init(&sellers[i].mailbox.value, SELLER_IDLE);
+        atomic_init(&sellers[i].mailbox.sleepers, 0);
+        atomic_init(&sellers[i].visit_generation, SNAPSHOT_NO_VISIT);
+    }
+
+    //Threads wait at the boundary of the first day until the main thread opens it.
+    atomic_init(&day_epoch.value, 1);
+}
+
+transaction_struct create_transaction(int customer_to_serve, operation_struct *operation, int simulation_day, bool is_successful, int seller_no){
+
+    transaction_struct newTransaction;
+    newTransaction.sequence_no = 0;
+    newTransaction.customer_no = customer_to_serve;
+    newTransaction.seller_no = seller_no;
+    newTransaction.product_type = operation->product_type;
+    newTransaction.operation_type = (unsigned char) operation->operation_type;
+    newTransaction.basket_size = 0;
+    newTransaction.product_amount = operation->product_amount;
+    newTransaction.simulation_day = simulation_day;
+    newTransaction.is_successful = is_successful;
+
+    return newTransaction;
+}
+
+void seed_random(random_struct *generator, uint64_t seed, uint64_t stream){
+
+    //The increment must be odd. Different increments give different sequences for the same seed.
+    generator->state = 0;
+    generator->increment = (stream << 1) | 1;
+
+    next_random(generator);
+    generator->state += seed;
+    next_random(generator);
+}
+
+uint32_t next_random(random_struct *generator){
+
+    uint64_t old_state = generator->state;
+    generator->state = old_state * 6364136223846793005ULL + generator->increment;
+
+    uint32_t shifted = (uint32_t) (((old_state >> 18) ^ old_state) >> 27);
+    uint32_t rotation = (uint32_t) (old_state >> 59);
+
+    return (shifted >> rotation) | (shifted << ((-rotation) & 31));
+}
+
+void create_alias_table(alias_table_struct *table, double *weights, int size){
+
+    double sum = 0;
+    double *scaled = malloc(size * sizeof(double));
+    int *small = malloc(size * sizeof(int));
+    int *large = malloc(size * sizeof(int));
+    int small_count = 0, large_count = 0;
+
+    free_alias_table(table);
+
+    table->size = size;
+    table->threshold = malloc(size * sizeof(uint32_t));
+    table->alias = malloc(size * sizeof(int));
+
+    for(int i = 0; i < size; i++) sum += weights[i];
+
+    //Every column holds the average weight. A column below it is filled up from one above it, which becomes its alias.
+    for(int i = 0; i < size; i++){
+
+        scaled[i] = weights[i] * size / sum;
+
+        if(scaled[i] < 1) small[small_count++] = i;
+        else large[large_count++] = i;
+    }
+
+    while(small_count > 0 && large_count > 0){
+
+        int less = small[--small_count];
+        int more = large[--large_count];
+
+        table->threshold[less] = (uint32_t) (scaled[less] * 4294967296.0);
+        table->alias[less] = more;
+
+        scaled[more] -= 1 - scaled[less];
+
+        if(scaled[more] < 1) small[small_count++] = more;
+        else large[large_count++] = more;
+    }
+
+    //The columns left are full, up to rounding.
+    while(large_count > 0){
+        int full = large[--large_count];
+        table->threshold[full] = UINT32_MAX;
+        table->alias[full] = full;
+    }
+
+    while(small_count > 0){
+        int full = small[--small_count];
+        table->threshold[full] = UINT32_MAX;
+        table->alias[full] = full;
+    }
+
+    free(scaled);
+    free(small);
+    free(large);
+}
+
+int sample_alias(alias_table_struct *table, random_struct *generator){
+
+    int column = random_below(generator, table->size);
+
+    return (next_random(generator) < table->threshold[column]) ? column : table->alias[column];
+}
+
+void free_alias_table(alias_table_struct *table){
+
+    free(table->threshold);
+    free(table->alias);
+
+    table->size = 0;
+    table->threshold = NULL;
+    table->alias = NULL;
+}
+
+//Without a workload section, each of these takes a single number, as it always did, so the same seed gives the
+//same operations.
+int draw_operation_type(random_struct *generator){
+
+    return (workload.operations.size > 0) ? sample_alias(&workload.operations, generator) : random_below(generator, 3);
+}
+
+int draw_product_type(random_struct *generator){
+
+    return (workload.products.size > 0) ? sample_alias(&workload.products, generator) : random_below(generator, number_of_products);
+}
+
+int draw_product_amount(random_struct *generator){
+
+    return ((workload.amounts.size > 0) ? sample_alias(&workload.amounts, generator) : random_below(generator, 5)) + 1;
+}
+
+int random_below(random_struct *generator, int bound){
+
+    //Multiplying instead of taking the remainder avoids a division.
+    return (int) (((uint64_t) next_random(generator) * (uint32_t) bound) >> 32);
+}
+
+reserve_struct *create_reserve(int customer_to_serve, operation_struct *operation){
+
+    reserve_struct *newReserve = allocate_reserve();
+    newReserve->customer_no = customer_to_serve;
+    newReserve->product_type = operation->product_type;
+    newReserve->product_amount = operation->product_amount;
+    newReserve->next = NULL;
+
+    return newReserve;
+}
+
+void add_to_transaction_list(transaction_struct *newTransactions, int count){
+
+    //Only the seller itself writes into its log, so we don't need any lock here.
+    transaction_log_struct *log = &sellers[newTransactions[0].seller_no].log;
+
+    //Only this seller writes into its shard, so counting needs no atomic operation.
+    shard_struct *shard = &sellers[newTransactions[0].seller_no].shard;
+
+    for(int i = 0; i < count; i++){
+
+        int index = 3 * newTransactions[i].simulation_day + newTransactions[i].operation_type;
+
+        shard->operations[index]++;
+        if(newTransactions[i].is_successful) shard->successful[index]++;
+
+        if(thread_metrics != NULL){
+
+            thread_metrics->operations[newTransactions[i].operation_type]++;
+            if(newTransactions[i].is_successful) thread_metrics->successful[newTransactions[i].operation_type]++;
+        }
+    }
+
+    //The sequence number keeps the order of the transactions between different sellers. A basket takes its numbers
+    //at once, so its transactions stay together.
+    uint64_t sequence_no = atomic_fetch_add_explicit(&transaction_sequence, (uint64_t) count, memory_order_relaxed);
+
+    //Without the log, only the customers are counted here. A customer visits one seller at a time, so its counter
+    //is never written by two sellers together. Everything else is added up from the shards at the end.
+    if(summary_only){
+        transaction_of_customer[newTransactions[0].customer_no] += count;
+        return;
+    }
+
+    for(int written = 0; written < count;){
+
+        //If there is no chunk or the last one is full, we need a new chunk.
+        if(log->tail == NULL || atomic_load_explicit(&log->tail->count, memory_order_relaxed) == TRANSACTION_CHUNK_SIZE){
+
+            transaction_chunk *newChunk = allocate_chunk(log);
+
+            if(log->tail == NULL) atomic_store_explicit(&log->head, newChunk, memory_order_release);
+            else atomic_store_explicit(&log->tail->next, newChunk, memory_order_release);
+
+            log->tail = newChunk;
+        }
+
+        int index = atomic_load_explicit(&log->tail->count, memory_order_relaxed);
+        int space = TRANSACTION_CHUNK_SIZE - index;
+        int part = (count - written < space) ? count - written : space;
+
+        for(int i = 0; i < part; i++){
+
+            transaction_struct *newTransaction = &log->tail->records[index + i];
+
+            *newTransaction = newTransactions[written + i];
+            newTransaction->sequence_no = sequence_no + written + i;
+        }
+
+        //The records must be complete before the writer thread can see them.
+        atomic_store_explicit(&log->tail->count, index + part, memory_order_release);
+        written += part;
+    }
+}
+
+bool take_from_stock(int product_type, int product_amount){
+
+    if(escrow_batch > 0) return take_from_escrow(product_type, product_amount);
+
+    atomic_int *stock = &products[product_type].num_of_instances[thread_bank->index];
+    int current = atomic_load_explicit(stock, memory_order_relaxed);
+
+    //If another seller changes the stock between our read and our update, the exchange fails and gives us the new value.
+    while(current >= product_amount){
+
+        if(atomic_compare_exchange_weak_explicit(stock, &current, current - product_amount, memory_order_acq_rel, memory_order_relaxed)){
+
+            if(thread_generation & 1)
+                atomic_fetch_sub_explicit(&products[product_type].snapshot_stock[thread_bank->index], product_amount, memory_order_relaxed);
+
+            mark_dirty(&thread_bank->dirty_products, product_type);
+            return true;
+        }
+
+        if(thread_metrics != NULL) thread_metrics->stock_retries++;
+    }
+
+    return false;
+}
+
+void return_to_stock(int product_type, int product_amount){
+
+    if(escrow_batch > 0){
+        return_to_escrow(product_type, product_amount);
+        return;
+    }
+
+    atomic_fetch_add_explicit(&products[product_type].num_of_instances[thread_bank->index], product_amount, memory_order_acq_rel);
+    mark_dirty(&thread_bank->dirty_products, product_type);
+
+    if(thread_generation & 1)
+        atomic_fetch_add_explicit(&products[product_type].snapshot_stock[thread_bank->index], product_amount, memory_order_relaxed);
+}
+
+void begin_product_update(int product_type){
+
+    //In escrow mode the sellers do not touch the stock and the sales of the product together, so there is nothing to
+    //keep apart from a reader.
+    if(escrow_batch > 0) return;
+
+    //Sellers never wait for each other or for a reader here, they only count themselves in. The fence keeps the
+    //changes of the stock and the sales after the count.
+    atomic_fetch_add_explicit(&products[product_type].version, PRODUCT_UPDATE_BEGIN, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+void end_product_update(int product_type){
+
+    if(escrow_batch > 0) return;
+
+    atomic_fetch_add_explicit(&products[product_type].version, PRODUCT_UPDATE_END, memory_order_release);
+}
+
+void add_to_sales(int product_type, int operation_type, int product_amount){
+
+    //An escrow seller keeps its sales to itself until the end of the day.
+    if(escrow_batch > 0){
+        thread_escrow[product_type].sales[operation_type] += product_amount;
+        return;
+    }
+
+    atomic_fetch_add_explicit(&products[product_type].sales[operation_type], product_amount, memory_order_relaxed);
+
+    //A visit which started after a snapshot is left out of it.
+    if(thread_generation & 1)
+        atomic_fetch_add_explicit(&products[product_type].snapshot_sales[operation_type], product_amount, memory_order_relaxed);
+}
+
+//Takes up to the wanted instances from the shared stock, and returns how many were taken.
+static int take_from_pool(int product_type, int wanted){
+
+    atomic_int *stock = &products[product_type].num_of_instances[thread_bank->index];
+    int current = atomic_load_explicit(stock, memory_order_relaxed);
+    int taken;
+
+    do{
+
+        taken = (current < wanted) ? current : wanted;
+        if(taken <= 0) return 0;
+
+    }while(atomic_compare_exchange_weak_explicit(stock, &current, current - taken, memory_order_acq_rel, memory_order_relaxed) == false);
+
+    return taken;
+}
+
+//Takes up to the wanted instances from the quotas of the other sellers, and returns how many were taken.
+static int take_from_sellers(int product_type, int wanted){
+
+    int taken = 0;
+
+    for(int i = 0; i < number_of_sellers && taken < wanted; i++){
+
+        atomic_int *quota = &sellers[i].escrow[thread_bank->index][product_type].quota;
+        if(quota == &thread_escrow[product_type].quota) continue;
+
+        int current = atomic_load_explicit(quota, memory_order_relaxed);
+        int part;
+
+        do{
+
+            part = (current < wanted - taken) ? current : wanted - taken;
+            if(part <= 0) break;
+
+        }while(atomic_compare_exchange_weak_explicit(quota, &current, current - part, memory_order_acq_rel, memory_order_relaxed) == false);
+
+        if(part <= 0) continue;
+
+        taken += part;
+        if(part == current) atomic_fetch_sub_explicit(&products[product_type].escrow_holders[thread_bank->index], 1, memory_order_relaxed);
+    }
+
+    return taken;
+}
+
+bool take_from_escrow(int product_type, int product_amount){
+
+    atomic_int *quota = &thread_escrow[product_type].quota;
+    atomic_int *holders = &products[product_type].escrow_holders[thread_bank->index];
+    int current = atomic_load_explicit(quota, memory_order_relaxed);
+
+    for(int attempt = 0; attempt < 2; attempt++){
+
+        //The seller sells from its own instances as long as they are enough. Only a seller taking instances from this
+        //one can change the quota meanwhile.
+        while(current >= product_amount){
+
+            if(atomic_compare_exchange_weak_explicit(quota, &current, current - product_amount, memory_order_acq_rel, memory_order_relaxed)){
+
+                if(current == product_amount) atomic_fetch_sub_explicit(holders, 1, memory_order_relaxed);
+                return true;
+            }
+
+            if(thread_metrics != NULL) thread_metrics->stock_retries++;
+        }
+
+        if(attempt == 1) break;
+
+        //The missing instances and a batch more come from the shared stock. When it runs out, other sellers give
+        //what they hold, so an operation only fails when the instances are missing everywhere. A sold out product is
+        //told apart by nobody else holding any of it, without looking at every seller.
+        int missing = product_amount - current;
+        int taken = take_from_pool(product_type, missing + escrow_batch);
+
+        if(taken > 0 && thread_metrics != NULL) thread_metrics->escrow_refills++;
+
+        if(taken < missing && atomic_load_explicit(holders, memory_order_relaxed) > (current > 0 ? 1 : 0)){
+
+            int stolen = take_from_sellers(product_type, missing - taken);
+
+            if(stolen > 0 && thread_metrics != NULL) thread_metrics->escrow_steals++;
+            taken += stolen;
+        }
+
+        if(taken == 0) return false;
+
+        mark_dirty(&thread_bank->dirty_products, product_type);
+
+        current = atomic_fetch_add_explicit(quota, taken, memory_order_acq_rel);
+        if(current == 0) atomic_fetch_add_explicit(holders, 1, memory_order_relaxed);
+        current += taken;
+    }
+
+    //The instances found stay in the quota, so they are not lost for the next operation.
+    return false;
+}
+
+void return_to_escrow(int product_type, int product_amount){
+
+    atomic_int *quota = &thread_escrow[product_type].quota;
+    int current = atomic_fetch_add_explicit(quota, product_amount, memory_order_acq_rel);
+
+    if(current == 0) atomic_fetch_add_explicit(&products[product_type].escrow_holders[thread_bank->index], 1, memory_order_relaxed);
+    current += product_amount;
+
+    mark_dirty(&thread_bank->dirty_products, product_type);
+
+    //A seller does not keep much more than two batches, the rest goes back to the shared stock for the others.
+    if(current > 2 * escrow_batch){
+
+        int extra = current - escrow_batch;
+
+        if(atomic_compare_exchange_strong_explicit(quota, &current, current - extra, memory_order_acq_rel, memory_order_relaxed))
+            atomic_fetch_add_explicit(&products[product_type].num_of_instances[thread_bank->index], extra, memory_order_acq_rel);
+    }
+}
+
+void settle_escrow(day_bank_struct *bank){
+
+    //A snapshot which sees the version change while it reads, or sees it odd, reads again, so it never sees some
+    //products settled and others not.
+    atomic_fetch_add(&settlement_version, 1);
+
+    //No visit of the day of this bank is in progress, so the quotas go back to the shared stock and the sales of every
+    //seller are handed in. Only the products touched during the day can have any.
+    for(int i = 0; i < bank->dirty_products.count; i++){
+
+        int index = bank->dirty_products.entries[i];
+
+        for(int j = 0; j < number_of_sellers; j++){
+
+            escrow_struct *escrow = &sellers[j].escrow[bank->index][index];
+
+            atomic_fetch_add(&products[index].num_of_instances[bank->index], atomic_exchange(&escrow->quota, 0));
+
+            for(int k = 0; k < 4; k++){
+                atomic_fetch_add(&products[index].sales[k], escrow->sales[k]);
+                escrow->sales[k] = 0;
+            }
+        }
+
+        atomic_store(&products[index].escrow_holders[bank->index], 0);
+    }
+
+    atomic_fetch_add(&settlement_version, 1);
+}
+
+void add_to_reserve_list(reserve_struct *newReserve){
+
+    //We only need to lock the stripe of this customer.
+    pthread_mutex_t *mutex = &reserve_mutex[newReserve->customer_no % RESERVE_LOCK_STRIPES];
+    reserve_list_struct *list = &thread_bank->reserve[newReserve->customer_no];
+
+    lock_reserve_stripe(mutex);
+
+    //New reservations go to the end of the customers list.
+    if(list->tail == NULL) list->head = newReserve;
+    else list->tail->next = newReserve;
+
+    list->tail = newReserve;
+
+    if(reservation_ttl > 0) schedule_reservation(newReserve);
+
+    unlock_reserve_stripe(mutex);
+}
+
+int cancel_reservation(int customer_to_serve, operation_struct *operation){
+
+    int returnValue = -1;
+
+    pthread_mutex_t *mutex = &reserve_mutex[customer_to_serve % RESERVE_LOCK_STRIPES];
+    reserve_list_struct *list = &thread_bank->reserve[customer_to_serve];
+
+    lock_reserve_stripe(mutex);
+
+    //The oldest reservation of the customer is cancelled first.
+    reserve_struct *to_delete = list->head;
+
+    if(to_delete != NULL){
+
+        returnValue = to_delete->product_amount;
+
+        operation->product_type = to_delete->product_type;
+
+        list->head = to_delete->next;
+        if(list->head == NULL) list->tail = NULL;
+
+        if(reservation_ttl > 0) unschedule_reservation(to_delete);
+    }
+
+    unlock_reserve_stripe(mutex);
+
+    if(to_delete != NULL) release_reserve(to_delete);
+
+    return returnValue;
+}
+
+bool take_reservations(int customer_to_serve, int count, reserve_struct **taken){
+
+    pthread_mutex_t *mutex = &reserve_mutex[customer_to_serve % RESERVE_LOCK_STRIPES];
+    reserve_list_struct *list = &thread_bank->reserve[customer_to_serve];
+    reserve_struct *current;
+    int found = 0;
+
+    lock_reserve_stripe(mutex);
+
+    //Nothing is taken unless the customer has enough reservations.
+    for(current = list->head; current != NULL && found < count; current = current->next) found++;
+
+    if(found == count){
+
+        for(int i = 0; i < count; i++){
+
+            taken[i] = list->head;
+            list->head = list->head->next;
+
+            if(reservation_ttl > 0) unschedule_reservation(taken[i]);
+        }
+
+        if(list->head == NULL) list->tail = NULL;
+    }
+
+    unlock_reserve_stripe(mutex);
+
+    return found == count;
+}
+
+static void wheel_insert(timer_wheel_struct *wheel, reserve_struct *node){
+
+    reserve_struct **slot;
+    uint64_t delta = node->expires_at - wheel->now;
+
+    //Close reservations go to the slot of their tick, the ones further away to the slot of their block of ticks.
+    if(delta < TIMER_WHEEL_SLOTS) slot = &wheel->ticks[node->expires_at & (TIMER_WHEEL_SLOTS - 1)];
+    else if(delta < TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS) slot = &wheel->blocks[(node->expires_at / TIMER_WHEEL_SLOTS) & (TIMER_WHEEL_SLOTS - 1)];
+    else slot = &wheel->overflow;
+
+    node->timer_next = *slot;
+    node->timer_link = slot;
+    if(*slot != NULL) (*slot)->timer_link = &node->timer_next;
+    *slot = node;
+}
+
+static void wheel_remove(reserve_struct *node){
+
+    *node->timer_link = node->timer_next;
+    if(node->timer_next != NULL) node->timer_next->timer_link = node->timer_link;
+}
+
+//Moves every reservation of a slot to the place it belongs to now.
+static void wheel_cascade(timer_wheel_struct *wheel, reserve_struct **slot){
+
+    reserve_struct *node = *slot;
+    *slot = NULL;
+
+    while(node != NULL){
+
+        reserve_struct *next = node->timer_next;
+        wheel_insert(wheel, node);
+        node = next;
+    }
+}
+
+static void expire_reservation(reserve_struct *node){
+
+    reserve_list_struct *list = &thread_bank->reserve[node->customer_no];
+
+    //The reservations of a customer expire in the order they were made, so this is almost always the oldest one.
+    if(list->head == node){
+
+        list->head = node->next;
+        if(list->head == NULL) list->tail = NULL;
+
+    }else{
+
+        reserve_struct *previous = list->head;
+        while(previous->next != node) previous = previous->next;
+
+        previous->next = node->next;
+        if(list->tail == node) list->tail = previous;
+    }
+
+    //The held instances can be sold again.
+    begin_product_update(node->product_type);
+    add_to_sales(node->product_type, 3, node->product_amount);
+    return_to_stock(node->product_type, node->product_amount);
+    end_product_update(node->product_type);
+
+    release_reserve(node);
+}
+
+void schedule_reservation(reserve_struct *node){
+
+    timer_wheel_struct *wheel = &thread_bank->timer_wheels[node->customer_no % RESERVE_LOCK_STRIPES];
+
+    advance_timer_wheel(wheel, operation_clock());
+
+    node->expires_at = operation_clock() + (uint64_t) reservation_ttl;
+    wheel_insert(wheel, node);
+    wheel->count++;
+}
+
+void unschedule_reservation(reserve_struct *node){
+
+    wheel_remove(node);
+    thread_bank->timer_wheels[node->customer_no % RESERVE_LOCK_STRIPES].count--;
+}
+
+void advance_timer_wheel(timer_wheel_struct *wheel, uint64_t target){
+
+    //An empty wheel has nothing to expire on the way.
+    if(wheel->count == 0){
+        if(target > wheel->now) wheel->now = target;
+        return;
+    }
+
+    while(wheel->now < target){
+
+        uint64_t tick = ++wheel->now;
+
+        //At the start of every block, its reservations come down to the ticks. The overflow is looked at once
+        //every round of the blocks.
+        if((tick & (TIMER_WHEEL_SLOTS - 1)) == 0){
+
+            if((tick & (TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS - 1)) == 0) wheel_cascade(wheel, &wheel->overflow);
+            wheel_cascade(wheel, &wheel->blocks[(tick / TIMER_WHEEL_SLOTS) & (TIMER_WHEEL_SLOTS - 1)]);
+        }
+
+        reserve_struct **slot = &wheel->ticks[tick & (TIMER_WHEEL_SLOTS - 1)];
+
+        while(*slot != NULL){
+
+            reserve_struct *node = *slot;
+
+            wheel_remove(node);
+            wheel->count--;
+            expire_reservation(node);
+        }
+
+        if(wheel->count == 0){
+            wheel->now = target;
+            return;
+        }
+    }
+}
+
+void sweep_reservations(){
+
+    static _Thread_local int stripe = 0;
+
+    //Every visit moves the wheel of one stripe forward, so the expiry work is spread over all sellers. If the stripe
+    //is busy, its owner is moving the wheel anyway.
+    if(pthread_mutex_trylock(&reserve_mutex[stripe]) == 0){
+
+        advance_timer_wheel(&thread_bank->timer_wheels[stripe], operation_clock());
+        pthread_mutex_unlock(&reserve_mutex[stripe]);
+    }
+
+    stripe = (stripe + 1) % RESERVE_LOCK_STRIPES;
+}
+
+void reset_timer_wheels(day_bank_struct *bank){
+
+    //The reservations themselves are freed with the lists of the customers.
+    memset(bank->timer_wheels, 0, RESERVE_LOCK_STRIPES * sizeof(timer_wheel_struct));
+
+    for(int i = 0; i < RESERVE_LOCK_STRIPES; i++) bank->timer_wheels[i].now = operation_clock();
+}
+
+uint64_t operation_clock(){
+
+    return atomic_load_explicit(&transaction_sequence, memory_order_relaxed);
+}
+
+static inline uint64_t merge_key(transaction_merge_struct *merge, int seller_no){
+
+    return merge->chunk[seller_no]->records[merge->position[seller_no]].sequence_no;
+}
+
+static void merge_sift_down(transaction_merge_struct *merge, int index){
+
+    while(true){
+
+        int smallest = index;
+        int left = 2 * index + 1, right = 2 * index + 2;
+
+        if(left < merge->heap_size && merge_key(merge, merge->heap[left]) < merge_key(merge, merge->heap[smallest])) smallest = left;
+        if(right < merge->heap_size && merge_key(merge, merge->heap[right]) < merge_key(merge, merge->heap[smallest])) smallest = right;
+
+        if(smallest == index) return;
+
+        int temp = merge->heap[index];
+        merge->heap[index] = merge->heap[smallest];
+        merge->heap[smallest] = temp;
+        index = smallest;
+    }
+}
+
+static void merge_sift_up(transaction_merge_struct *merge, int index){
+
+    while(index > 0){
+
+        int parent = (index - 1) / 2;
+
+        if(merge_key(merge, merge->heap[parent]) <= merge_key(merge, merge->heap[index])) return;
+
+        int temp = merge->heap[index];
+        merge->heap[index] = merge->heap[parent];
+        merge->heap[parent] = temp;
+        index = parent;
+    }
+}
+
+//Tells whether the seller has a published transaction which is not written yet. Chunks which are written completely
+//are freed on the way.
+static bool transaction_ready(transaction_merge_struct *merge, int seller_no){
+
+    transaction_chunk *chunk = merge->chunk[seller_no];
+
+    if(chunk == NULL){
+
+        chunk = atomic_load_explicit(&sellers[seller_no].log.head, memory_order_acquire);
+        if(chunk == NULL) return false;
+
+        merge->chunk[seller_no] = chunk;
+    }
+
+    if(merge->position[seller_no] < atomic_load_explicit(&chunk->count, memory_order_acquire)) return true;
+    if(merge->position[seller_no] < TRANSACTION_CHUNK_SIZE) return false;
+
+    //The seller never touches a full chunk again once it has linked the next one, so it can be given back to be filled again.
+    transaction_chunk *next = atomic_load_explicit(&chunk->next, memory_order_acquire);
+    if(next == NULL) return false;
+
+    atomic_store_explicit(&sellers[seller_no].log.head, next, memory_order_relaxed);
+    release_chunk(&sellers[seller_no].log, chunk);
+
+    merge->chunk[seller_no] = next;
+    merge->position[seller_no] = 0;
+
+    return atomic_load_explicit(&next->count, memory_order_acquire) > 0;
+}
+
+void begin_transaction_merge(transaction_merge_struct *merge){
+
+    merge->heap = malloc(number_of_sellers * sizeof(int));
+    merge->waiting = malloc(number_of_sellers * sizeof(int));
+    merge->chunk = calloc(number_of_sellers, sizeof(transaction_chunk *));
+    merge->position = calloc(number_of_sellers, sizeof(int));
+    merge->heap_size = 0;
+    merge->next_sequence = 0;
+
+    //No seller has published anything yet.
+    for(int i = 0; i < number_of_sellers; i++) merge->waiting[i] = i;
+    merge->waiting_count = number_of_sellers;
+}
+
+int write_ready_transactions(transaction_merge_struct *merge){
+
+    int written = 0;
+
+    while(true){
+
+        //The top of the heap holds the seller with the smallest sequence number. Sequence numbers have no gaps, so
+        //it can only be written if it is the next one.
+        if(merge->heap_size > 0 && merge_key(merge, merge->heap[0]) == merge->next_sequence){
+
+            int seller_no = merge->heap[0];
+
+            write_transaction(&merge->chunk[seller_no]->records[merge->position[seller_no]++]);
+            merge->next_sequence++;
+            written++;
+
+            if(transaction_ready(merge, seller_no) == false){
+
+                merge->waiting[merge->waiting_count++] = seller_no;
+                merge->heap[0] = merge->heap[--merge->heap_size];
+            }
+
+            merge_sift_down(merge, 0);
+            continue;
+        }
+
+        //The next transaction may belong to a seller which had nothing published before.
+        bool moved = false;
+
+        for(int i = 0; i < merge->waiting_count;){
+
+            int seller_no = merge->waiting[i];
+
+            if(transaction_ready(merge, seller_no)){
+
+                merge->waiting[i] = merge->waiting[--merge->waiting_count];
+                merge->heap[merge->heap_size++] = seller_no;
+                merge_sift_up(merge, merge->heap_size - 1);
+                moved = true;
+            }
+            else i++;
+        }
+
+        if(moved == false) return written;
+    }
+}
+
+void end_transaction_merge(transaction_merge_struct *merge){
+
+    free(merge->heap);
+    free(merge->waiting);
+    free(merge->chunk);
+    free(merge->position);
+}
+
+//</editor-fold>
+//////////////////////////////////////////////////////// - OUTPUT OPERATIONS
+//<editor-fold desc="OUTPUT OPERATIONS">
+
+void start_writer(){
+
+    transaction_of_customer = calloc(number_of_customers, sizeof(uint64_t));
+    transaction_of_seller = calloc(number_of_sellers, sizeof(uint64_t));
+
+    open_output();
+
+    //Without the transactions there is nothing to merge, so no writer is needed.
+    if(summary_only) return;
+
+    if(record_file != NULL) open_trace();
+
+    output_format("%s\t%s\t%s\t%s\t%s\n", "Customer_ID", "Seller_ID", "Operation", "Simulation_Day", "Is Successful");
+    output_format("-------------------------------------------------------------------------\n");
+
+    //The transactions of a recovered run come first. They are in the journal already.
+    for(size_t i = 0; i < recovered_length; i++) write_transaction(&recovered_transactions[i]);
+    free(recovered_transactions);
+
+    if(journal_name != NULL) open_journal();
+
+    atomic_init(&writer_stop, false);
+
+    int thread_control = pthread_create(&writer_id, NULL, &writer_thread, NULL);
+
+    if(thread_control){
+        fprintf(stderr, "Error: return code from creating writer thread is %d\n", thread_control);
+        exit(-1);
+    }
+}
+
+void stop_writer(){
+
+    if(summary_only){
+        count_from_shards();
+        return;
+    }
+
+    //All sellers are joined, so every transaction is already published. The writer leaves after writing them.
+    atomic_store(&writer_stop, true);
+
+    int thread_control = pthread_join(writer_id, NULL);
+
+    if(thread_control){
+        fprintf(stderr, "Error: return code from joining the writer thread is %d\n", thread_control);
+        exit(-1);
+    }
+
+    if(record_file != NULL) close_trace();
+    if(journal_name != NULL) close_journal();
+}
+
+void count_from_shards(){
+
+    //Every transaction of a seller is in its shard, split by day and operation type.
+    for(int i = 0; i < number_of_sellers; i++){
+
+        for(int day = 0; day < number_of_simulation_days; day++){
+
+            for(int type = 0; type < 3; type++){
+
+                uint64_t operations = sellers[i].shard.operations[3 * day + type];
+
+                transaction_of_seller[i] += operations;
+                transaction_of_operation[type] += (long long) operations;
+            }
+        }
+    }
+}
+
+void *writer_thread(void *argument){
+
+    (void) argument;
+
+    transaction_merge_struct merge;
+
+    begin_transaction_merge(&merge);
+
+    while(true){
+
+        //The flag is read before writing, so nothing published before the stop can be missed.
+        bool stopping = atomic_load(&writer_stop);
+        int written = write_ready_transactions(&merge);
+
+        //The transactions written since the last commit become durable together.
+        if(journal_file != NULL) commit_journal(false);
+
+        if(written > 0) continue;
+        if(stopping) break;
+
+        //The sellers are behind us, so we give them some time.
+        usleep(1000);
+    }
+
+    end_transaction_merge(&merge);
+
+    return NULL;
+}
+
+static char *write_number(char *cursor, uint64_t number){
+
+    char digits[20];
+    int length = 0;
+
+    do{
+        digits[length++] = (char) ('0' + number % 10);
+        number /= 10;
+    }while(number > 0);
+
+    while(length > 0) *cursor++ = digits[--length];
+
+    return cursor;
+}
+
+static char *write_text(char *cursor, const char *text, size_t length){
+
+    memcpy(cursor, text, length);
+
+    return cursor + length;
+}
+
+void output_counts(const char *label, int number, const char *separator, uint64_t *counts, int count){
+
+    //A line is never longer than this, so we only check the space once.
+    if(output.used + 128 > OUTPUT_BUFFER_SIZE) flush_output();
+
+    char *cursor = output.buffer[output.current] + output.used;
+    size_t separator_length = strlen(separator);
+
+    cursor = write_text(cursor, label, strlen(label));
+    cursor = write_number(cursor, (uint64_t) number);
+
+    for(int i = 0; i < count; i++){
+
+        cursor = write_text(cursor, separator, separator_length);
+        cursor = write_number(cursor, counts[i]);
+    }
+
+    *cursor++ = '\n';
+
+    output.used = cursor - output.buffer[output.current];
+}
+
+void write_transaction(transaction_struct *transaction){
+
+    static const char *operation_name[] = { "BUY", "RESERVE", "CANCEL" };
+    static const size_t operation_length[] = { 3, 7, 6 };
+
+    int operation = transaction->operation_type < 2 ? transaction->operation_type : 2;
+
+    transaction_of_customer[transaction->customer_no]++;
+    transaction_of_seller[transaction->seller_no]++;
+    transaction_of_operation[operation]++;
+
+    if(trace_file != NULL) record_transaction(transaction);
+    if(journal_file != NULL) journal_transaction(transaction);
+
+    //A line is never longer than this, so we only check the space once.
+    if(output.used + 128 > OUTPUT_BUFFER_SIZE) flush_output();
+
+    char *cursor = output.buffer[output.current] + output.used;
+
+    cursor = write_number(cursor, transaction->customer_no + 1);
+    cursor = write_text(cursor, "\t\t", 2);
+    cursor = write_number(cursor, transaction->seller_no + 1);
+    cursor = write_text(cursor, "\t\t", 2);
+    cursor = write_text(cursor, operation_name[operation], operation_length[operation]);
+    cursor = write_text(cursor, "\t\t\t", 3);
+    cursor = write_number(cursor, transaction->simulation_day + 1);
+    cursor = write_text(cursor, "\t", 1);
+    cursor = transaction->is_successful ? write_text(cursor, "true\n", 5) : write_text(cursor, "false\n", 6);
+
+    output.used = cursor - output.buffer[output.current];
+}
+
+void open_output(){
+
+    output.fd = open("Output.txt", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if(output.fd == -1){
+        fprintf(stderr, "Error: \"Output.txt\" could not be created: %s\n", strerror(errno));
+        exit(1);
+    }
+
+    output.offset = 0;
+    output.current = 0;
+    output.used = 0;
+    output.write_pending = false;
+    output.buffer[0] = malloc(OUTPUT_BUFFER_SIZE);
+    output.buffer[1] = malloc(OUTPUT_BUFFER_SIZE);
+
+    //If the kernel has no io_uring, we simply write the buffers ourselves.
+    output.use_ring = use_io_uring && setup_ring(&output.ring);
+}
+
+void output_format(const char *format, ...){
+
+    va_list arguments;
+
+    //Only the short lines of the summary go through here.
+    if(output.used + 256 > OUTPUT_BUFFER_SIZE) flush_output();
+
+    va_start(arguments, format);
+    output.used += vsnprintf(output.buffer[output.current] + output.used, OUTPUT_BUFFER_SIZE - output.used, format, arguments);
+    va_end(arguments);
+}
+
+static void write_all(char *buffer, size_t size, off_t offset){
+
+    while(size > 0){
+
+        ssize_t result = pwrite(output.fd, buffer, size, offset);
+
+        if(result == -1 && errno == EINTR) continue;
+
+        if(result <= 0){
+            fprintf(stderr, "Error: writing \"Output.txt\" failed: %s\n", strerror(errno));
+            exit(1);
+        }
+
+        buffer += result;
+        size -= result;
+        offset += result;
+    }
+}
+
+//Waits until the kernel has written the other buffer. A short write is completed by hand.
+static void finish_pending_write(){
+
+    if(output.write_pending == false) return;
+
+    int result = wait_for_write(&output.ring);
+    char *buffer = output.buffer[1 - output.current];
+    off_t offset = output.offset - output.pending_size;
+
+    output.write_pending = false;
+
+    if(result < 0){
+
+        //The kernel may not know the write operation, so we stop using the ring.
+        close_ring(&output.ring);
+        output.use_ring = false;
+        result = 0;
+    }
+
+    if((size_t) result < output.pending_size) write_all(buffer + result, output.pending_size - result, offset + result);
+}
+
+void flush_output(){
+
+    if(output.used == 0) return;
+
+    if(output.use_ring == false){
+
+        write_all(output.buffer[output.current], output.used, output.offset);
+        output.offset += output.used;
+        output.used = 0;
+
+        return;
+    }
+
+    //The other buffer must be free before we fill it.
+    finish_pending_write();
+
+    if(output.use_ring == false){
+        flush_output();
+        return;
+    }
+
+    submit_write(&output.ring, output.fd, output.buffer[output.current], output.used, output.offset);
+
+    output.write_pending = true;
+    output.pending_size = output.used;
+    output.offset += output.used;
+    output.current = 1 - output.current;
+    output.used = 0;
+}
+
+void close_output(){
+
+    flush_output();
+    finish_pending_write();
+
+    if(output.use_ring) close_ring(&output.ring);
+
+    close(output.fd);
+
+    free(output.buffer[0]);
+    free(output.buffer[1]);
+}
+
+bool setup_ring(ring_struct *ring){
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    //Only one write is in flight at a time, so a small ring is enough.
+    ring->fd = (int) syscall(__NR_io_uring_setup, 4, &params);
+    if(ring->fd < 0) return false;
+
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    //Newer kernels map both queues with a single call.
+    if(params.features & IORING_FEAT_SINGLE_MMAP){
+        if(ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    ring->cq_ring = MAP_FAILED;
+    ring->sqes = MAP_FAILED;
+
+    if(ring->sq_ring != MAP_FAILED){
+
+        if(params.features & IORING_FEAT_SINGLE_MMAP) ring->cq_ring = ring->sq_ring;
+        else ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+
+        ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    }
+
+    if(ring->sq_ring == MAP_FAILED || ring->cq_ring == MAP_FAILED || ring->sqes == MAP_FAILED){
+
+        if(ring->sqes != MAP_FAILED) munmap(ring->sqes, ring->sqes_size);
+        if(ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+        if(ring->sq_ring != MAP_FAILED) munmap(ring->sq_ring, ring->sq_ring_size);
+        close(ring->fd);
+
+        return false;
+    }
+
+    ring->sq_tail = (unsigned *) ((char *) ring->sq_ring + params.sq_off.tail);
+    ring->sq_mask = (unsigned *) ((char *) ring->sq_ring + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *) ((char *) ring->sq_ring + params.sq_off.array);
+    ring->cq_head = (unsigned *) ((char *) ring->cq_ring + params.cq_off.head);
+    ring->cq_tail = (unsigned *) ((char *) ring->cq_ring + params.cq_off.tail);
+    ring->cq_mask = (unsigned *) ((char *) ring->cq_ring + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) ((char *) ring->cq_ring + params.cq_off.cqes);
+
+    return true;
+}
+
+void submit_write(ring_struct *ring, int fd, char *buffer, size_t size, off_t offset){
+
+    unsigned tail = *ring->sq_tail;
+    unsigned index = tail & *ring->sq_mask;
+
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) buffer;
+    sqe->len = (uint32_t) size;
+    sqe->off = (uint64_t) offset;
+
+    ring->sq_array[index] = index;
+
+    //The kernel reads the entry only after it sees the new tail.
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    while(syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, NULL, 0) == -1){
+
+        if(errno != EINTR){
+            fprintf(stderr, "Error: submitting a write to io_uring failed: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+}
+
+int wait_for_write(ring_struct *ring){
+
+    unsigned head = *ring->cq_head;
+
+    while(head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)){
+
+        if(syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) == -1 && errno != EINTR){
+            fprintf(stderr, "Error: waiting for io_uring failed: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+
+    int result = ring->cqes[head & *ring->cq_mask].res;
+
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+    return result;
+}
+
+void close_ring(ring_struct *ring){
+
+    munmap(ring->sqes, ring->sqes_size);
+    if(ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+}
+
+//</editor-fold>
+//////////////////////////////////////////////////////// - SNAPSHOT OPERATIONS
+//<editor-fold desc="SNAPSHOT OPERATIONS">
+
+void create_snapshot(inventory_snapshot_struct *snapshot){
+
+    snapshot->num_of_instances = malloc(number_of_products * sizeof(int));
+    snapshot->sales = malloc(number_of_products * sizeof(*snapshot->sales));
+
+    if(snapshot->num_of_instances == NULL || snapshot->sales == NULL){
+        fprintf(stderr, "Error: could not allocate memory for an inventory snapshot\n");
+        exit(1);
+    }
+}
+
+//Waits until every seller which started its visit before the given generation is done with it.
+static void wait_for_visits_before(uint64_t generation){
+
+    for(int i = 0; i < number_of_sellers; i++){
+
+        uint64_t seen;
+        int spins = 0;
+
+        //Visits are short, and only the reader waits here. It sleeps if the seller is not running.
+        while((seen = atomic_load(&sellers[i].visit_generation)) != SNAPSHOT_NO_VISIT && seen < generation){
+
+            if(++spins < 1000) cpu_relax();
+            else usleep(10);
+        }
+    }
+}
+
+void take_snapshot(inventory_snapshot_struct *snapshot){
+
+    int epoch, day;
+    unsigned settlement;
+
+    snapshot->retries = 0;
+
+    //The snapshot opens a new generation. The visits which started before it are over before anything is read, and
+    //the ones which start after it are taken out again, so every visit is either wholly in the snapshot or not at all.
+    uint64_t generation = atomic_fetch_add(&snapshot_generation, 1) + 1;
+    wait_for_visits_before(generation);
+
+    do{
+
+        //The stock is the one of the newest day. Before the first day and after the last one, it is the closest day.
+        epoch = atomic_load(&day_epoch.value);
+        day = epoch / 2;
+        if(day >= number_of_simulation_days) day = number_of_simulation_days - 1;
+
+        int bank = day % 2;
+
+        //The main thread hands in the escrow of a finished day quickly and never waits for the reader.
+        while((settlement = atomic_load(&settlement_version)) & 1){
+
+            snapshot->retries++;
+            cpu_relax();
+        }
+
+        for(int i = 0; i < number_of_products; i++){
+
+            product_struct *product = &products[i];
+            uint64_t before, after;
+
+            //Only the reader tries again, a seller in the middle of an update never waits for it. A product is taken
+            //when no seller was updating it and no update finished while it was read.
+            while(true){
+
+                before = atomic_load_explicit(&product->version, memory_order_acquire);
+
+                if(PRODUCT_UPDATERS(before) == 0){
+
+                    snapshot->num_of_instances[i] = atomic_load_explicit(&product->num_of_instances[bank], memory_order_relaxed) -
+                                                    atomic_load_explicit(&product->snapshot_stock[bank], memory_order_relaxed);
+
+                    for(int j = 0; j < 4; j++)
+                        snapshot->sales[i][j] = atomic_load_explicit(&product->sales[j], memory_order_relaxed) -
+                                                atomic_load_explicit(&product->snapshot_sales[j], memory_order_relaxed);
+
+                    atomic_thread_fence(memory_order_acquire);
+                    after = atomic_load_explicit(&product->version, memory_order_relaxed);
+
+                    if(after == before) break;
+                }
+
+                snapshot->retries++;
+                cpu_relax();
+            }
+        }
+
+    //When a day opens meanwhile, the bank read at the beginning may be restored for a later day, so we start again.
+    //The same goes for an escrow settlement, which changes the sales of many products.
+    }while(atomic_load(&day_epoch.value) / 2 != epoch / 2 || atomic_load(&settlement_version) != settlement);
+
+    snapshot->simulation_day = day;
 
-int number_of_customers;
-int number_of_sellers;
-int number_of_simulation_days;
-int number_of_products;
+    //After the visits of the closed generation are over, nobody adds to the changes on the side until the next
+    //snapshot, so they are cleared for it.
+    atomic_store(&snapshot_generation, generation + 1);
+    wait_for_visits_before(generation + 1);
 
-int current_simulation_day;
+    for(int i = 0; i < number_of_products; i++){
 
-int *num_of_instances_of_product;
-int **customer_information;
-int *seller_to_customer;
-int **product_sales;
+        for(int j = 0; j < 2; j++) atomic_store_explicit(&products[i].snapshot_stock[j], 0, memory_order_relaxed);
+        for(int j = 0; j < 4; j++) atomic_store_explicit(&products[i].snapshot_sales[j], 0, memory_order_relaxed);
+    }
+}
 
-bool *customer_status;
-bool *current_day_initialized;
+void begin_snapshot_visit(int seller_no){
 
-pthread_t *customer_ids;
-pthread_t *seller_ids;
+    if(monitor_interval_ms == 0) return;
 
-pthread_mutex_t *seller_mutex;
-pthread_mutex_t transaction_mutex;
-pthread_mutex_t reserve_mutex;
-pthread_mutex_t *product_mutex;
+    _Atomic uint64_t *visit = &sellers[seller_no].visit_generation;
+    uint64_t generation = atomic_load(&snapshot_generation);
 
-customer_struct *customers;
-reserve_struct *reserve = NULL;
-transaction_struct *transaction = NULL;
+    //The seller shows its generation before looking at it again, and the reader opens a generation before looking at
+    //the sellers. So either the reader waits for this visit, or the visit works in the new generation.
+    while(true){
 
-//</editor-fold>
-//////////////////////////////////////////////////////// - PROTOTYPES OF FUNCTIONS
-//<editor-fold desc="PROTOTYPES OF FUNCTIONS">
+        atomic_store(visit, generation);
 
-void read_file();
-void read_from_file(FILE *fp);
-void create_necessary_variables();
+        uint64_t current = atomic_load(&snapshot_generation);
+        if(current == generation) break;
 
-void create_threads();
-void manage_threads();
-void join_threads();
+        generation = current;
+    }
 
-void *customer_thread(void *argument);
-void *seller_thread(void *argument);
+    thread_generation = generation;
+}
 
-transaction_struct *create_transaction(int customer_to_serve, int simulation_day, bool is_successful, int seller_no);
-reserve_struct *create_reserve(int customer_to_serve);
+void end_snapshot_visit(int seller_no){
 
-void add_to_transaction_list(transaction_struct *newTransaction);
-void add_to_reserve_list(reserve_struct *newReserve);
-int cancel_reservation(int customer_to_serve);
-void delete_reservation(reserve_struct *to_delete, reserve_struct *previous);
+    if(monitor_interval_ms == 0) return;
 
-void print_summary();
-void clean_up();
-void clean_reserve_list();
-void clean_transaction_list();
+    thread_generation = 0;
+    atomic_store_explicit(&sellers[seller_no].visit_generation, SNAPSHOT_NO_VISIT, memory_order_release);
+}
 
-//</editor-fold>
-//////////////////////////////////////////////////////// - MAIN METHOD
+void free_snapshot(inventory_snapshot_struct *snapshot){
 
-int main(){
+    free(snapshot->num_of_instances);
+    free(snapshot->sales);
+}
 
-    //Before beginning we need to make sure that the program create different random numbers on every sequence.
-    srand((unsigned int) time(0));
+void start_monitor(){
 
-    //Reading the input file.
-    read_file();
+    atomic_init(&monitor_stop, false);
 
-    //Creating necessary variables.
-    create_necessary_variables();
+    int thread_control = pthread_create(&monitor_id, NULL, &monitor_thread, NULL);
 
-    //Creating the threads.
-    create_threads();
+    if(thread_control){
+        fprintf(stderr, "Error: return code from creating monitor thread is %d\n", thread_control);
+        exit(-1);
+    }
+}
 
-    //Managing threads;
-    manage_threads();
+void stop_monitor(){
 
-    //When the job is done, we need to join all threads.
-    join_threads();
+    atomic_store(&monitor_stop, true);
 
-    //Printing the summary and cleaning up spaces allocated.
-    print_summary();
-    clean_up();
+    int thread_control = pthread_join(monitor_id, NULL);
 
-    return 0;
+    if(thread_control){
+        fprintf(stderr, "Error: return code from joining the monitor thread is %d\n", thread_control);
+        exit(-1);
+    }
 }
 
-//////////////////////////////////////////////////////// - READING OPERATIONS
-//<editor-fold desc="READING OPERATIONS">
+void *monitor_thread(void *argument){
 
-void read_file(){
+    (void) argument;
 
-    FILE *fp;
+    inventory_snapshot_struct snapshot;
+    struct timespec next;
 
-    if(access("input.txt", F_OK) != -1){
+    create_snapshot(&snapshot);
+    clock_gettime(CLOCK_MONOTONIC, &next);
 
-        fp = fopen("input.txt", "r");
-        read_from_file(fp);
+    while(true){
 
-    }else{
+        next.tv_nsec += (long) (monitor_interval_ms % 1000) * 1000000L;
+        next.tv_sec += monitor_interval_ms / 1000 + next.tv_nsec / 1000000000L;
+        next.tv_nsec %= 1000000000L;
 
-        printf("\"input.txt\" does not exist. Please make sure it exists before starting this program.\n");
-        exit(1);
-    }
+        while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) == EINTR);
+
+        if(atomic_load(&monitor_stop)) break;
 
-    //Also we need to reset the values of customer_status and seller_to_customer;
-    if(customer_status != NULL && seller_to_customer != NULL){
-        for(int i = 0; i < number_of_customers; i++) customer_status[i] = true;
-        for(int i = 0; i < number_of_sellers; i++) seller_to_customer[i] = -1;
+        take_snapshot(&snapshot);
+        print_snapshot(&snapshot);
     }
 
-    //We will create space for current_day_initialized if it is not already allocated.
-    if(current_day_initialized == NULL){
-        current_day_initialized = malloc(number_of_simulation_days * sizeof(bool));
+    free_snapshot(&snapshot);
 
-        //Also, we need to set all values of it to zero except the first day since we already initialized it.
-        current_day_initialized[0] = true;
-        for(int i = 1; i < number_of_simulation_days; i++) current_day_initialized[i] = false;
+    return NULL;
+}
+
+void print_snapshot(inventory_snapshot_struct *snapshot){
+
+    long long stock = 0, sales[4] = {0, 0, 0, 0};
+    struct timespec now;
+
+    for(int i = 0; i < number_of_products; i++){
+
+        stock += snapshot->num_of_instances[i];
+        for(int j = 0; j < 4; j++) sales[j] += snapshot->sales[i][j];
     }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double seconds = (now.tv_sec - simulation_start.tv_sec) + (now.tv_nsec - simulation_start.tv_nsec) / 1e9;
+
+    printf("Snapshot at %.3f s, day %d: %lld in stock, BUY %lld, RESERVE %lld, CANCEL %lld", seconds, snapshot->simulation_day + 1,
+           stock, sales[0], sales[1], sales[2]);
+    if(reservation_ttl > 0) printf(", EXPIRED %lld", sales[3]);
+    if(escrow_batch > 0) printf(", not counting the instances and the sales the sellers keep until the day ends");
+    printf(" (%llu retries)\n", (unsigned long long) snapshot->retries);
 }
 
-void read_from_file(FILE *fp){
+//</editor-fold>
+//////////////////////////////////////////////////////// - TRACE OPERATIONS
+//<editor-fold desc="TRACE OPERATIONS">
 
-    int loop_count = 0, i;
-    char input[64];
-    char *token;
+void open_trace(){
 
-    while(!feof(fp)){ // NOLINT
+    trace_header_struct header;
 
-        if(fgets(input, 63, fp) != NULL){
+    trace_file = fopen(record_file, "wb");
 
-            // We know that the first four line will contain the total number of some information.
-            if(loop_count < 4){
+    if(trace_file == NULL){
+        fprintf(stderr, "Error: \"%s\" could not be created: %s\n", record_file, strerror(errno));
+        exit(1);
+    }
 
-                token = strtok(input, " ");
+    //The writer thread appends one record for every transaction, so the file gets a large buffer.
+    setvbuf(trace_file, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
 
-                switch(loop_count){
-                    case 0:
-                        number_of_customers = (int) strtol(token, NULL, 10);
-                        break;
-                    case 1:
-                        number_of_sellers = (int) strtol(token, NULL, 10);
-                        break;
-                    case 2:
-                        number_of_simulation_days = (int) strtol(token, NULL, 10);
-                        break;
-                    case 3:
-                        number_of_products = (int) strtol(token, NULL, 10);
-                        break;
-                    default:break;
-                }
-            }else if(loop_count < 4 + number_of_products){
+    memset(&header, 0, sizeof(header));
+    //Days are kept in 16 bits in the records.
+    if(number_of_simulation_days > UINT16_MAX){
+        fprintf(stderr, "Error: a trace can hold at most %d days\n", UINT16_MAX);
+        exit(1);
+    }
 
-                //Now, we will loop by product count.
-                //Also, just for the first time we need to allocate some space if it is not already allocated.
-                if(loop_count == 4 && num_of_instances_of_product == NULL)
-                    num_of_instances_of_product = malloc(number_of_products * sizeof(int));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.number_of_customers = (uint32_t) number_of_customers;
+    header.number_of_products = (uint32_t) number_of_products;
+    header.number_of_simulation_days = (uint32_t) number_of_simulation_days;
 
-                num_of_instances_of_product[loop_count - 4] = (int) strtol(input, NULL, 10);
-            }else{
+    fwrite(&header, sizeof(header), 1, trace_file);
+}
 
-                //And lastly, we need to fill in customers information.
-                //Firstly, lets allocate some space for it if it is not already allocated.
-                if(loop_count == 4 + number_of_products && customer_information == NULL){
-                    customer_information = malloc(number_of_customers * sizeof(int *));
+void record_transaction(transaction_struct *transaction){
 
-                    for(i = 0; i < number_of_customers; i++)
-                        customer_information[i] = malloc(3 * sizeof(int));
-                }
+    trace_record_struct record;
 
-                token = strtok(input, " ");
-                customer_information[loop_count - 4 - number_of_products][0] = (int) strtol(token, NULL, 10);
+    record.customer_no = (uint32_t) transaction->customer_no;
+    record.product_type = (uint32_t) transaction->product_type;
+    record.product_amount = transaction->product_amount;
+    record.simulation_day = (uint16_t) transaction->simulation_day;
+    record.operation_type = transaction->operation_type;
+    record.basket_size = transaction->basket_size;
 
-                token = strtok(NULL, " ");
-                customer_information[loop_count - 4 - number_of_products][1] = (int) strtol(token, NULL, 10);
+    fwrite(&record, sizeof(record), 1, trace_file);
+}
 
-                token = strtok(NULL, "\n");
-                customer_information[loop_count - 4 - number_of_products][2] = (int) strtol(token, NULL, 10);
-            }
+void close_trace(){
 
-            loop_count++;
-        }
+    if(fclose(trace_file) != 0){
+        fprintf(stderr, "Error: writing \"%s\" failed: %s\n", record_file, strerror(errno));
+        exit(1);
     }
 }
 
-//</editor-fold>
-//////////////////////////////////////////////////////// - THREADS
-//<editor-fold desc="THREADS">
+static void trace_error(char *message){
 
-void create_threads(){
+    fprintf(stderr, "%s: %s\n", replay_file, message);
+    exit(1);
+}
 
-    //First, we need to create the arrays which will hold ids.
-    customer_ids = malloc(number_of_customers * sizeof(pthread_t));
-    seller_ids = malloc(number_of_sellers * sizeof(pthread_t));
+void load_trace(){
 
-    int i, thread_control;
+    struct stat file_info;
+    int fd = open(replay_file, O_RDONLY);
 
-    //Creating mutexes.
-    seller_mutex = malloc(number_of_sellers * sizeof(pthread_mutex_t));
+    if(fd == -1 || fstat(fd, &file_info) == -1){
+        fprintf(stderr, "Error: \"%s\" could not be opened: %s\n", replay_file, strerror(errno));
+        exit(1);
+    }
 
-    for(i = 0; i < number_of_sellers; i++){
+    if((size_t) file_info.st_size < sizeof(trace_header_struct) || (file_info.st_size - sizeof(trace_header_struct)) % sizeof(trace_record_struct) != 0)
+        trace_error("not a trace file");
+
+    //The whole trace is read while the simulation runs, so it is brought into memory right away.
+    trace_map_size = (size_t) file_info.st_size;
+    trace_map = mmap(NULL, trace_map_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
 
-        pthread_mutex_init(&seller_mutex[i], NULL);
+    if(trace_map == MAP_FAILED){
+        fprintf(stderr, "Error: \"%s\" could not be mapped: %s\n", replay_file, strerror(errno));
+        exit(1);
     }
 
-    pthread_mutex_init(&transaction_mutex, NULL);
-    pthread_mutex_init(&reserve_mutex, NULL);
+    trace_header_struct *header = trace_map;
 
-    //Creating customer threads.
-    for(i = 0; i < number_of_customers; i++){
+    if(memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0) trace_error("not a trace file");
 
-        thread_control = pthread_create(&customer_ids[i], NULL, &customer_thread, (void *)(intptr_t) i);
+    //The trace only makes sense with the input it was recorded with. The number of sellers may differ.
+    if(header->number_of_customers != (uint32_t) number_of_customers || header->number_of_products != (uint32_t) number_of_products ||
+       header->number_of_simulation_days != (uint32_t) number_of_simulation_days)
+        trace_error("the trace was recorded with a different number of customers, products or days");
 
-        if(thread_control){
-            fprintf(stderr, "Error: return code from creating customer thread is %d\n", thread_control);
-            exit(-1);
-        }
-    }
+    trace_records = (trace_record_struct *) (header + 1);
+    trace_length = (file_info.st_size - sizeof(trace_header_struct)) / sizeof(trace_record_struct);
 
-    //Creating seller threads.
-    for(i = 0; i < number_of_sellers; i++){
+    trace_position = malloc(number_of_customers * sizeof(size_t));
+    trace_next = malloc((trace_length > 0 ? trace_length : 1) * sizeof(size_t));
+    trace_customers_of_day = calloc(number_of_simulation_days, sizeof(int));
 
-        thread_control = pthread_create(&seller_ids[i], NULL, &seller_thread, (void *)(intptr_t) i);
+    size_t *last_visit = malloc(number_of_customers * sizeof(size_t));
 
-        if(thread_control){
-            fprintf(stderr, "Error: return code from creating seller thread is %d\n", thread_control);
-            exit(-1);
-        }
-    }
-}
+    for(int i = 0; i < number_of_customers; i++) trace_position[i] = last_visit[i] = TRACE_END;
 
-void join_threads(){
+    //The records of a visit come one after the other, and the first one holds the size of the visit. Every visit is
+    //linked to the next visit of the same customer. The customers come back in about the same order in the replay,
+    //so the trace is read almost from start to end.
+    for(size_t i = 0; i < trace_length;){
 
-    int i, thread_control;
+        trace_record_struct *first = &trace_records[i];
 
-    for(i = 0; i < number_of_customers; i++){
+        if(first->basket_size == 0 || first->basket_size > MAX_BASKET_SIZE || i + first->basket_size > trace_length)
+            trace_error("a visit of the trace is broken");
 
-        thread_control = pthread_join(customer_ids[i], NULL);
+        for(size_t j = i; j < i + first->basket_size; j++){
 
-        if(thread_control){
-            fprintf(stderr, "Error: return code from joining the customer thread is %d\n", thread_control);
-            exit(-1);
+            trace_record_struct *record = &trace_records[j];
+
+            if(record->customer_no != first->customer_no || record->simulation_day != first->simulation_day ||
+               (j > i && record->basket_size != 0))
+                trace_error("a visit of the trace is broken");
+
+            if(record->customer_no >= (uint32_t) number_of_customers || record->product_type >= (uint32_t) number_of_products ||
+               record->simulation_day >= number_of_simulation_days || record->operation_type > 2 || record->product_amount < 0)
+                trace_error("a record of the trace is out of range");
         }
-    }
 
-    for(i = 0; i < number_of_sellers; i++){
+        int customer_no = (int) first->customer_no;
+        size_t last = last_visit[customer_no];
 
-        thread_control = pthread_join(seller_ids[i], NULL);
+        //The days of a customer only grow, so every new day of a customer starts a new group of visits.
+        if(last == TRACE_END){
+            trace_position[customer_no] = i;
+            trace_customers_of_day[first->simulation_day]++;
+        }else{
+            if(trace_records[last].simulation_day > first->simulation_day) trace_error("the days of a customer go back in the trace");
+            if(trace_records[last].simulation_day != first->simulation_day) trace_customers_of_day[first->simulation_day]++;
 
-        if(thread_control){
-            fprintf(stderr, "Error: return code from joining the seller thread is %d\n", thread_control);
-            exit(-1);
+            trace_next[last] = i;
         }
-    }
 
-    //Destroying mutexes.
-    for(i = 0; i < number_of_sellers; i++){
+        trace_next[i] = TRACE_END;
+        last_visit[customer_no] = i;
+
+        if(first->basket_size > basket_capacity) basket_capacity = first->basket_size;
 
-        pthread_mutex_destroy(&seller_mutex[i]);
+        i += first->basket_size;
     }
 
-    pthread_mutex_destroy(&transaction_mutex);
-    pthread_mutex_destroy(&reserve_mutex);
+    free(last_visit);
 }
 
-void manage_threads(){
+void replay_operation(int customer_no){
 
-    //We created all threads. Since 10 seconds correspond to one simulation day, we need to suspend the main thread for 10 seconds.
-    while(current_simulation_day < number_of_simulation_days){
-        sleep(1);
-        current_simulation_day++;
-        printf("Day %d ended.\n",current_simulation_day);
+    operation_struct *basket = customer_basket(customer_no);
+    size_t position = trace_position[customer_no];
+    int day = customers[customer_no].visit_day;
 
-        //After the current day finishes, we need to reset all information.
-        //To be able to do that, we need to wait for all customers and sellers to finish their current job.
-        for(int i = 0; i < number_of_sellers; i++){
-            while(seller_to_customer[i] != -1);
-        }
+    customers[customer_no].basket_size = 0;
 
-        //Now, all jobs has finished, we can reset all values back to original.
-        read_file();
+    //Visits of an earlier day can only be left when that day ended before they were replayed.
+    while(position != TRACE_END && trace_records[position].simulation_day < day) position = trace_next[position];
 
-        //We need to clear the reserve list, as well.
-        clean_reserve_list();
+    trace_position[customer_no] = position;
 
-        //Also, we will set the current days flag to true if the simulation has not ended.
-        if(current_simulation_day != number_of_simulation_days) current_day_initialized[current_simulation_day] = true;
-    }
-}
+    //The customer has nothing more to do today.
+    if(position == TRACE_END || trace_records[position].simulation_day > day) return;
 
-void *customer_thread(void *argument){
+    int basket_size = trace_records[position].basket_size;
 
-    int i = 0;
-    int operation_type, product_type, product_amount;
-    int status = -1;
-    int customer_no = (int)(intptr_t) argument;
+    for(int i = 0; i < basket_size; i++){
 
-    //While the simulation days is not over...
-    while(current_simulation_day != number_of_simulation_days){
+        trace_record_struct *record = &trace_records[position + i];
 
-        //Before doing anything, we should check if the current day has been initialized.
-        while(current_day_initialized[current_simulation_day] == false);
+        basket[i].operation_type = record->operation_type;
+        basket[i].product_type = (int) record->product_type;
+        basket[i].product_amount = record->product_amount;
+    }
 
-        int current_day = current_simulation_day;
+    customers[customer_no].basket_size = basket_size;
+    trace_position[customer_no] = trace_next[position];
+}
 
-        if(customer_status[customer_no] == false){
+bool trace_visits_left(int customer_no){
 
-            //If this is the case, this customer cannot do anything else until the current day finishes. So we need to suspend it.
-            while(current_day == current_simulation_day);
+    size_t position = trace_position[customer_no];
 
-            goto end_of_customer;
-        }
+    return position != TRACE_END && trace_records[position].simulation_day == customers[customer_no].visit_day;
+}
 
-        //For each operation, we need another random number for the type of the operation. We have 3 different operations.
-        operation_type = (int) random() % 3;
+void free_trace(){
 
-        if(operation_type == 0){ // BUY PRODUCT
+    munmap(trace_map, trace_map_size);
+    free(trace_position);
+    free(trace_next);
+    free(trace_customers_of_day);
+}
 
-            product_type = (int) random() % number_of_products;
-            product_amount = (int) (random() % 5) + 1;
+//</editor-fold>
+//////////////////////////////////////////////////////// - JOURNAL OPERATIONS
+//<editor-fold desc="JOURNAL OPERATIONS">
 
-            customers[customer_no].operation_type = 0;
-            customers[customer_no].product_type = product_type;
-            customers[customer_no].product_amount = product_amount;
+static void journal_error(char *message){
 
-        }else if(operation_type == 1){ // RESERVE PRODUCT
+    fprintf(stderr, "%s: %s\n", journal_name, message);
+    exit(1);
+}
 
-            product_type = (int) random() % number_of_products;
-            product_amount = (int) (random() % 5) + 1;
+static uint32_t checksum_record(uint32_t checksum, journal_record_struct *record){
 
-            customers[customer_no].operation_type = 1;
-            customers[customer_no].product_type = product_type;
-            customers[customer_no].product_amount = product_amount;
+    uint32_t words[sizeof(journal_record_struct) / sizeof(uint32_t)];
 
-        }else{ // CANCEL RESERVATION
+    //The record is taken a word at a time, so the writer thread does not spend much on it.
+    memcpy(words, record, sizeof(words));
 
-            customers[customer_no].operation_type = 2;
-        }
+    for(size_t i = 0; i < sizeof(words) / sizeof(uint32_t); i++) checksum = (checksum ^ words[i]) * 16777619u;
 
-        //Customer needs to find an empty seller as long as we're on the same day.
-        while(current_day == current_simulation_day){
+    return checksum;
+}
 
-            for(i = 0; i < number_of_sellers; i++){
+//Applies a committed transaction of the day the run goes on with to the bank of that day.
+static void recover_transaction(journal_record_struct *record, day_bank_struct *bank){
 
-                status = pthread_mutex_trylock(&seller_mutex[i]);
+    int customer_no = (int) record->customer_no;
+    int product_type = (int) record->product_type;
+    operation_struct operation = { record->operation_type, product_type, record->product_amount };
 
-                //If we able to lock anything which means we found an empty seller, we will exit the loop.
-                if(status != EBUSY)
-                    break;
-            }
+    bank->customer_rights[customer_no]--;
+    mark_dirty(&bank->dirty_customers, customer_no);
 
-            if(status != EBUSY)
-                break;
-        }
+    if(record->is_successful == false) return;
 
-        //We need to reset the loop if we're not on the same day.
-        if(current_day != current_simulation_day){
-            if(status != EBUSY && status != -1) pthread_mutex_unlock(&seller_mutex[i]);
-            continue;
-        }
+    mark_dirty(&bank->dirty_products, product_type);
 
-        //Now, we need a way to communicate with the seller. So we set the arrays value.
-        seller_to_customer[i] = customer_no;
+    if(operation.operation_type == 2){
 
-        //We need to keep the customer waiting until its job finishes.
-        while(seller_to_customer[i] == customer_no);
+        //The oldest reservation of the customer was cancelled, just like in the run.
+        if(cancel_reservation(customer_no, &operation) != record->product_amount || operation.product_type != product_type)
+            journal_error("a cancellation of the journal does not match the reservations");
 
-        end_of_customer:;
+        products[product_type].num_of_instances[bank->index] += record->product_amount;
+        return;
     }
 
-    pthread_exit(NULL);
-}
-
-void *seller_thread(void *argument){
+    products[product_type].num_of_instances[bank->index] -= record->product_amount;
 
-    int customer_to_serve, operation_type;
-    int seller_no = (int)(intptr_t) argument;
+    if(operation.operation_type == 1){
+        add_to_reserve_list(create_reserve(customer_no, &operation));
+        bank->customer_reserve_left[customer_no] -= record->product_amount;
+    }
+}
 
-    //While the simulation days is not over...
-    while(current_simulation_day != number_of_simulation_days){
+void recover_journal(){
 
-        //The seller waits for a customer to lock its mutex until the end of its execution.
-        while(seller_to_customer[seller_no] == -1)
-            if(current_simulation_day == number_of_simulation_days) goto end_of_seller;
+    struct stat file_info;
+    int fd = open(journal_name, O_RDWR);
 
-        //Now, the seller can do a job.
-        customer_to_serve = seller_to_customer[seller_no];
-        operation_type = customers[customer_to_serve].operation_type;
+    //A new journal starts with this run.
+    if(fd == -1 && errno == ENOENT) return;
 
-        //Firstly, we need to check if that customer has any operation right.
-        if(customer_information[customer_to_serve][1] <= 0){
+    if(fd == -1 || fstat(fd, &file_info) == -1){
+        fprintf(stderr, "Error: \"%s\" could not be opened: %s\n", journal_name, strerror(errno));
+        exit(1);
+    }
 
-            //Means the customer has no right to do its job.
-            customer_status[customer_to_serve] = false;
+    if(file_info.st_size == 0){
+        close(fd);
+        return;
+    }
 
-        }else{
+    if((size_t) file_info.st_size < sizeof(journal_header_struct)) journal_error("not a journal file");
 
-            if(operation_type == 0){ // BUY PRODUCT
+    size_t map_size = (size_t) file_info.st_size;
+    void *map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
 
-                //We need to check if that amount exists.
-                if(num_of_instances_of_product[customers[customer_to_serve].product_type] < customers[customer_to_serve].product_amount){
+    if(map == MAP_FAILED){
+        fprintf(stderr, "Error: \"%s\" could not be mapped: %s\n", journal_name, strerror(errno));
+        exit(1);
+    }
 
-                    //Means wanted amount do not exist. Unsuccessful transaction.
-                    add_to_transaction_list(create_transaction(customer_to_serve, current_simulation_day, false, seller_no));
+    journal_header_struct *header = map;
+    journal_record_struct *records = (journal_record_struct *) (header + 1);
+    size_t length = (map_size - sizeof(journal_header_struct)) / sizeof(journal_record_struct);
+    size_t committed = 0, group_start = 0;
+    uint32_t checksum = JOURNAL_CHECKSUM_SEED;
+    bool is_closed = false;
+    int day = 0;
 
-                }else{
+    if(memcmp(header->magic, JOURNAL_MAGIC, sizeof(header->magic)) != 0) journal_error("not a journal file");
 
-                    //We can make this transaction successfully.
-                    add_to_transaction_list(create_transaction(customer_to_serve, current_simulation_day, true, seller_no));
+    if(header->number_of_customers != (uint32_t) number_of_customers || header->number_of_sellers != (uint32_t) number_of_sellers ||
+       header->number_of_products != (uint32_t) number_of_products || header->number_of_simulation_days != (uint32_t) number_of_simulation_days)
+        journal_error("the journal was written with a different number of customers, sellers, products or days");
 
-                    //Lastly, we need to decrease the amount from product amount.
-                    pthread_mutex_lock(&product_mutex[customers[customer_to_serve].product_type]);
-                    num_of_instances_of_product[customers[customer_to_serve].product_type] -= customers[customer_to_serve].product_amount;
-                    product_sales[customers[customer_to_serve].product_type][0] += customers[customer_to_serve].product_amount;
-                    pthread_mutex_unlock(&product_mutex[customers[customer_to_serve].product_type]);
-                }
+    //Only the groups which end with a valid commit record count. Whatever comes after the last one was never made
+    //durable, or was being written when the run stopped.
+    for(size_t i = 0; i < length; i++){
 
-            }else if(operation_type == 1){ // RESERVE PRODUCT
+        if(records[i].operation_type != JOURNAL_COMMIT){
 
-                //We need to check if that amount exists.
-                if(num_of_instances_of_product[customers[customer_to_serve].product_type] < customers[customer_to_serve].product_amount){
+            checksum = checksum_record(checksum, &records[i]);
+            continue;
+        }
 
-                    //Means wanted amount do not exist. Unsuccessful transaction.
-                    add_to_transaction_list(create_transaction(customer_to_serve, current_simulation_day, false, seller_no));
+        if(records[i].customer_no != i - group_start || records[i].product_type != checksum) break;
 
-                }else if(customer_information[customer_to_serve][2] < customers[customer_to_serve].product_amount){
+        is_closed = records[i].is_successful;
+        committed = group_start = i + 1;
+        checksum = JOURNAL_CHECKSUM_SEED;
+    }
 
-                    //Secondly, we need to check if customers reserve amount is enough. If this is the case, unsuccessful transaction.
-                    add_to_transaction_list(create_transaction(customer_to_serve, current_simulation_day, false, seller_no));
+    for(size_t i = 0; i < committed; i++){
 
-                }else{
+        journal_record_struct *record = &records[i];
 
-                    //We can make this transaction successfully.
-                    add_to_transaction_list(create_transaction(customer_to_serve, current_simulation_day, true, seller_no));
+        if(record->operation_type == JOURNAL_COMMIT) continue;
 
-                    //We need to decrease the amount from product amount.
-                    pthread_mutex_lock(&product_mutex[customers[customer_to_serve].product_type]);
-                    num_of_instances_of_product[customers[customer_to_serve].product_type] -= customers[customer_to_serve].product_amount;
-                    product_sales[customers[customer_to_serve].product_type][1] += customers[customer_to_serve].product_amount;
-                    pthread_mutex_unlock(&product_mutex[customers[customer_to_serve].product_type]);
+        if(record->customer_no >= (uint32_t) number_of_customers || record->seller_no >= number_of_sellers ||
+           record->product_type >= (uint32_t) number_of_products || record->simulation_day >= number_of_simulation_days ||
+           record->operation_type > 2 || record->product_amount < 0)
+            journal_error("a record of the journal is out of range");
 
-                    //Also, we need to add this to the reserve list.
-                    add_to_reserve_list(create_reserve(customer_to_serve));
+        if(record->simulation_day > day) day = record->simulation_day;
+    }
 
-                    //We need to decrease from customers allowed reservation count.
-                    customer_information[customer_to_serve][2] -= customers[customer_to_serve].product_amount;
-                }
+    //The run goes on with the newest day in the journal, and with the operations the stopped run would have drawn.
+    //A run which was over has nothing left to do.
+    random_seed = header->random_seed;
+    recovered_day = is_closed ? number_of_simulation_days : day;
+    atomic_store(&current_simulation_day, recovered_day);
 
-            }else{ // CANCEL RESERVATION
+    for(int i = 0; i < number_of_customers; i++) seed_random(&customer_random[i], random_seed, (uint64_t) i);
 
-                int product_amount = cancel_reservation(customer_to_serve);
-                bool is_successful;
+    day_bank_struct *bank = &day_banks[day % 2];
+    recovered_transactions = malloc((committed > 0 ? committed : 1) * sizeof(transaction_struct));
+    recovered_length = 0;
 
-                if(product_amount == -1) is_successful = false;
-                else is_successful = true;
+    thread_bank = bank;
 
-                //We need to make the transaction.
-                add_to_transaction_list(create_transaction(customer_to_serve, current_simulation_day, is_successful, seller_no));
+    for(size_t i = 0; i < committed;){
 
-                pthread_mutex_lock(&product_mutex[customers[customer_to_serve].product_type]);
-                if(is_successful == true){
-                    product_sales[customers[customer_to_serve].product_type][2] += product_amount;
-		    num_of_instances_of_product[customers[customer_to_serve].product_type] += product_amount;
-		}
-                pthread_mutex_unlock(&product_mutex[customers[customer_to_serve].product_type]);
-            }
+        journal_record_struct *first = &records[i];
 
-            //We need to decrease from customers allowed operation count.
-            customer_information[customer_to_serve][1]--;
+        if(first->operation_type == JOURNAL_COMMIT){
+            i++;
+            continue;
         }
 
-        //Since seller finished its job, we need to reset its status.
-        seller_to_customer[seller_no] = -1;
+        //A group is only committed between visits, so every visit is whole.
+        if(first->basket_size == 0 || first->basket_size > MAX_BASKET_SIZE || i + first->basket_size > committed)
+            journal_error("a visit of the journal is broken");
 
-        //We will release the mutex.
-        pthread_mutex_unlock(&seller_mutex[seller_no]);
+        for(size_t j = i; j < i + first->basket_size; j++){
 
-        end_of_seller:;
-    }
+            journal_record_struct *record = &records[j];
 
-    pthread_exit(NULL);
-}
+            if(record->operation_type == JOURNAL_COMMIT || record->customer_no != first->customer_no ||
+               record->simulation_day != first->simulation_day || (j > i && record->basket_size != 0))
+                journal_error("a visit of the journal is broken");
 
-//</editor-fold>
-//////////////////////////////////////////////////////// - OTHER FUNCTIONS
-//<editor-fold desc="OTHER FUNCTIONS">
+            transaction_struct *transaction = &recovered_transactions[recovered_length++];
 
-void create_necessary_variables(){
+            transaction->sequence_no = 0;
+            transaction->customer_no = (int) record->customer_no;
+            transaction->seller_no = record->seller_no;
+            transaction->product_type = (int) record->product_type;
+            transaction->product_amount = record->product_amount;
+            transaction->simulation_day = record->simulation_day;
+            transaction->operation_type = record->operation_type;
+            transaction->basket_size = record->basket_size;
+            transaction->is_successful = record->is_successful;
 
-    customers = malloc(number_of_customers * sizeof(customer_struct));
-    customer_status = malloc(number_of_customers * sizeof(bool));
+            shard_struct *shard = &sellers[record->seller_no].shard;
 
-    seller_to_customer = malloc(number_of_sellers * sizeof(int));
+            shard->operations[3 * record->simulation_day + record->operation_type]++;
+            if(record->is_successful) shard->successful[3 * record->simulation_day + record->operation_type]++;
 
-    product_mutex = malloc(number_of_products * sizeof(pthread_mutex_t));
+            if(record->is_successful)
+                products[record->product_type].sales[record->operation_type] += record->product_amount;
 
-    product_sales = malloc(number_of_products * sizeof(int *));
-    for(int i = 0; i < number_of_products; i++) product_sales[i] = calloc(3, sizeof(int));
+            //The customer drew the type of the operation, and the product and the amount of a purchase or a reservation.
+            draw_operation_type(&customer_random[record->customer_no]);
+            if(record->operation_type != 2){
+                draw_product_type(&customer_random[record->customer_no]);
+                draw_product_amount(&customer_random[record->customer_no]);
+            }
+        }
 
-    //Also we need to reset the values of customer_status and seller_to_customer;
-    for(int i = 0; i < number_of_customers; i++) customer_status[i] = true;
-    for(int i = 0; i < number_of_sellers; i++) seller_to_customer[i] = -1;
-}
+        //Only the newest day is still going on. Its purchases and reservations come before its cancellations, as
+        //they did in the visit.
+        if(first->simulation_day == day && is_closed == false){
 
-transaction_struct *create_transaction(int customer_to_serve, int simulation_day, bool is_successful, int seller_no){
+            thread_slab = &sellers[first->seller_no].slab[bank->index];
 
-    transaction_struct *newTransaction = malloc(sizeof(transaction_struct));
-    newTransaction->customer_no = customer_to_serve;
-    newTransaction->seller_no = seller_no;
-    newTransaction->operation_type = customers[customer_to_serve].operation_type;
-    newTransaction->product_amount = customers[customer_to_serve].product_amount;
-    newTransaction->simulation_day = simulation_day;
-    newTransaction->is_successful = is_successful;
-    newTransaction->next = NULL;
+            for(size_t j = i; j < i + first->basket_size; j++)
+                if(records[j].operation_type != 2) recover_transaction(&records[j], bank);
 
-    return newTransaction;
-}
+            for(size_t j = i; j < i + first->basket_size; j++)
+                if(records[j].operation_type == 2) recover_transaction(&records[j], bank);
 
-reserve_struct *create_reserve(int customer_to_serve){
+            recovered_operations += first->basket_size;
+        }
 
-    reserve_struct *newReserve = malloc(sizeof(reserve_struct));
-    newReserve->customer_no = customer_to_serve;
-    newReserve->product_type = customers[customer_to_serve].product_type;
-    newReserve->product_amount = customers[customer_to_serve].product_amount;
-    newReserve->next = NULL;
+        i += first->basket_size;
+    }
 
-    return newReserve;
-}
+    thread_bank = NULL;
+    thread_slab = NULL;
 
-void add_to_transaction_list(transaction_struct *newTransaction){
+    for(int i = 0; i < number_of_products; i++){
 
-    //We need to lock the mutex to provide synchronization.
-    pthread_mutex_lock(&transaction_mutex);
+        //A purchase can take a sequence number before the cancellation whose instances it bought, so a product can
+        //end below zero when the journal stops between the two. It goes on with an empty stock.
+        if(products[i].num_of_instances[bank->index] < 0) products[i].num_of_instances[bank->index] = 0;
+    }
 
-    //First we need to check if any transaction exists.
-    if(transaction == NULL){
-        transaction = newTransaction;
-    }else{
+    for(int i = 0; i < number_of_customers; i++)
+        if(initial_customer_rights[i] > 0 && bank->customer_rights[i] <= 0) recovered_customers_done++;
 
-        //We need to find the last element in the linked list.
-        transaction_struct *current = transaction;
-        while(current->next != NULL)
-            current = current->next;
+    munmap(map, map_size);
 
-        current->next = newTransaction;
+    //The part after the last commit is dropped, new groups are appended right after it.
+    if(ftruncate(fd, (off_t) (sizeof(journal_header_struct) + committed * sizeof(journal_record_struct))) == -1){
+        fprintf(stderr, "Error: \"%s\" could not be truncated: %s\n", journal_name, strerror(errno));
+        exit(1);
     }
 
-    pthread_mutex_unlock(&transaction_mutex);
+    close(fd);
+
+    if(is_closed) printf("Recovered %zu transactions from \"%s\", the run was already over.\n", recovered_length, journal_name);
+    else printf("Recovered %zu transactions from \"%s\", going on with day %d.\n", recovered_length, journal_name, recovered_day + 1);
 }
 
-void add_to_reserve_list(reserve_struct *newReserve){
+void open_journal(){
 
-    //We need to lock the mutex to provide synchronization.
-    pthread_mutex_lock(&reserve_mutex);
+    journal_header_struct header;
 
-    //First we need to check if any reserve exists.
-    if(reserve == NULL){
-        reserve = newReserve;
-    }else{
+    journal_file = fopen(journal_name, "ab");
+
+    if(journal_file == NULL){
+        fprintf(stderr, "Error: \"%s\" could not be opened: %s\n", journal_name, strerror(errno));
+        exit(1);
+    }
+
+    //The writer thread appends one record for every transaction, so the file gets a large buffer.
+    setvbuf(journal_file, NULL, _IOFBF, OUTPUT_BUFFER_SIZE);
+
+    //Days and sellers are kept in 16 bits in the records.
+    if(number_of_simulation_days > UINT16_MAX || number_of_sellers > UINT16_MAX){
+        fprintf(stderr, "Error: a journal can hold at most %d days and %d sellers\n", UINT16_MAX, UINT16_MAX);
+        exit(1);
+    }
 
-        //We need to find the last element in the linked list.
-        reserve_struct *current = reserve;
-        while(current->next != NULL)
-            current = current->next;
+    //A recovered journal already has its header.
+    if(ftell(journal_file) == 0){
 
-        current->next = newReserve;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+        header.number_of_customers = (uint32_t) number_of_customers;
+        header.number_of_sellers = (uint32_t) number_of_sellers;
+        header.number_of_products = (uint32_t) number_of_products;
+        header.number_of_simulation_days = (uint32_t) number_of_simulation_days;
+        header.random_seed = random_seed;
+
+        fwrite(&header, sizeof(header), 1, journal_file);
     }
 
-    pthread_mutex_unlock(&reserve_mutex);
+    journal_pending = 0;
+    journal_checksum = JOURNAL_CHECKSUM_SEED;
+    journal_visit_left = 0;
+    clock_gettime(CLOCK_MONOTONIC, &last_commit);
 }
 
-int cancel_reservation(int customer_to_serve){
+void journal_transaction(transaction_struct *transaction){
 
-    int returnValue = -1;
+    journal_record_struct record;
 
-    //First we need to check if any reserve exists.
-    if(reserve != NULL){
+    memset(&record, 0, sizeof(record));
+    record.customer_no = (uint32_t) transaction->customer_no;
+    record.product_type = (uint32_t) transaction->product_type;
+    record.product_amount = transaction->product_amount;
+    record.seller_no = (uint16_t) transaction->seller_no;
+    record.simulation_day = (uint16_t) transaction->simulation_day;
+    record.operation_type = transaction->operation_type;
+    record.is_successful = transaction->is_successful;
+    record.basket_size = transaction->basket_size;
 
-        //We need to traverse the list until we find a matching customer number.
-        reserve_struct *current = reserve;
-        reserve_struct *pre_current = NULL;
+    fwrite(&record, sizeof(record), 1, journal_file);
 
-        while(current != NULL){
+    journal_checksum = checksum_record(journal_checksum, &record);
+    journal_pending++;
 
-            if(current->customer_no == customer_to_serve){
+    if(transaction->basket_size > 0) journal_visit_left = transaction->basket_size;
+    journal_visit_left--;
+}
 
-                returnValue = current->product_amount;
+void commit_journal(bool is_closing){
 
-                customers[customer_to_serve].product_type = current->product_type;
+    journal_record_struct record;
+    struct timespec now;
 
-                //Delete the reservation.
-                delete_reservation(current, pre_current);
+    //Many visits of many sellers share one commit. A group is only closed between two visits.
+    if(is_closing == false){
 
-                break;
+        if(journal_pending == 0 || journal_visit_left > 0) return;
 
-            }else{
-                pre_current = current;
-                current = current->next;
-            }
-        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        long elapsed_ms = (now.tv_sec - last_commit.tv_sec) * 1000L + (now.tv_nsec - last_commit.tv_nsec) / 1000000L;
+        if(elapsed_ms < commit_interval_ms) return;
     }
 
-    return returnValue;
-}
+    memset(&record, 0, sizeof(record));
+    record.customer_no = journal_pending;
+    record.product_type = journal_checksum;
+    record.operation_type = JOURNAL_COMMIT;
+    record.is_successful = is_closing;
 
-void delete_reservation(reserve_struct *to_delete, reserve_struct *previous){
+    fwrite(&record, sizeof(record), 1, journal_file);
 
-    //We need to lock the mutex to provide synchronization.
-    pthread_mutex_lock(&reserve_mutex);
+    //The group is durable once the data reaches the disk, the size of the file is enough for the rest.
+    if(fflush(journal_file) != 0 || fdatasync(fileno(journal_file)) != 0){
+        fprintf(stderr, "Error: writing \"%s\" failed: %s\n", journal_name, strerror(errno));
+        exit(1);
+    }
 
-    if(reserve == to_delete){
+    journal_pending = 0;
+    journal_checksum = JOURNAL_CHECKSUM_SEED;
+    clock_gettime(CLOCK_MONOTONIC, &last_commit);
+}
 
-        //Means this is the first entry.
-        reserve = to_delete->next;
+void close_journal(){
 
-    }else
-        previous->next = to_delete->next;
+    //The last commit marks the run as over, so starting it again does not run any day twice.
+    commit_journal(true);
 
-    free(to_delete);
+    if(fclose(journal_file) != 0){
+        fprintf(stderr, "Error: writing \"%s\" failed: %s\n", journal_name, strerror(errno));
+        exit(1);
+    }
 
-    pthread_mutex_unlock(&reserve_mutex);
+    journal_file = NULL;
 }
 
 //</editor-fold>
@@ -669,115 +4816,136 @@ void delete_reservation(reserve_struct *to_delete, reserve_struct *previous){
 
 void print_summary(){
 
-    char operation_name[16];
+    uint64_t sales[4];
+    int columns = reservation_ttl > 0 ? 4 : 3;
 
-    //We need to create a file.
-    FILE *fp = fopen("Output.txt", "w");
+    //The transactions are already written by the writer thread, which has counted them on the way. Nothing here
+    //depends on the number of transactions, only on the number of customers, sellers and products.
+    if(summary_only == false) output_format("\n\n");
+    output_format("NUMBER OF TRANSACTION\n\n");
 
-    fprintf(fp, "%s\t%s\t%s\t%s\t%s\n", "Customer_ID", "Seller_ID", "Operation", "Simulation_Day", "Is Successful");
-    fprintf(fp, "-------------------------------------------------------------------------\n");
+    for(int i = 0; i < number_of_customers; i++) output_counts("Customer #", (i + 1), " - ", &transaction_of_customer[i], 1);
+    output_format("\n");
+    for(int i = 0; i < number_of_sellers; i++) output_counts("Seller #", (i + 1), " - ", &transaction_of_seller[i], 1);
 
-    transaction_struct *current = transaction;
+    ////////////////////////////////////////////////////////
 
-    while(current != NULL){
+    output_format("\n\nPRODUCT INFORMATION\n\n");
 
-        if(current->operation_type == 0) strcpy(operation_name, "BUY");
-        else if(current->operation_type == 1) strcpy(operation_name, "RESERVE");
-        else strcpy(operation_name, "CANCEL");
+    for(int i = 0; i < number_of_products; i++){
 
-        fprintf(fp, "%d\t\t%d\t\t%s\t\t\t%d\t", (current->customer_no + 1), (current->seller_no + 1), operation_name, (current->simulation_day + 1));
-        fprintf(fp, "%s\n", current->is_successful ? "true" : "false");
+        for(int j = 0; j < columns; j++) sales[j] = (uint64_t) atomic_load_explicit(&products[i].sales[j], memory_order_relaxed);
 
-        current = current->next;
+        //The expired instances are only shown when reservations can expire.
+        output_counts("Product #", (i + 1), "\t", sales, columns);
     }
 
     ////////////////////////////////////////////////////////
 
-    fprintf(fp, "\n\nNUMBER OF TRANSACTION\n\n");
-
-    current = transaction;
-    int transaction_of_customer[number_of_customers];
-    int transaction_of_seller[number_of_sellers];
+    close_output();
+}
 
-    for(int i = 0; i < number_of_customers; i++) transaction_of_customer[i] = 0;
-    for(int i = 0; i < number_of_sellers; i++) transaction_of_seller[i] = 0;
+void write_report(){
 
-    while(current != NULL){
+    static const char *wait_name[] = { "spin", "block", "adaptive" };
+    static const char *dispatch_name[] = { "trylock", "queue" };
 
-        transaction_of_customer[current->customer_no]++;
-        transaction_of_seller[current->seller_no]++;
+    FILE *fp = fopen(report_file, "a");
 
-        current = current->next;
+    if(fp == NULL){
+        fprintf(stderr, "Error: \"%s\" could not be opened: %s\n", report_file, strerror(errno));
+        exit(1);
     }
 
-    for(int i = 0; i < number_of_customers; i++) fprintf(fp, "Customer #%d - %d\n", (i + 1), transaction_of_customer[i]);
-    fprintf(fp, "\n");
-    for(int i = 0; i < number_of_sellers; i++) fprintf(fp, "Seller #%d - %d\n", (i + 1), transaction_of_seller[i]);
-
-    ////////////////////////////////////////////////////////
-
-    fprintf(fp, "\n\nPRODUCT INFORMATION\n\n");
-
-    for(int i = 0; i < number_of_products; i++){
+    double seconds = (simulation_end.tv_sec - simulation_start.tv_sec) + (simulation_end.tv_nsec - simulation_start.tv_nsec) / 1e9;
+    long long operations = transaction_of_operation[0] + transaction_of_operation[1] + transaction_of_operation[2];
+    int threads = pool_mode ? number_of_workers : number_of_customers + number_of_sellers;
 
-        fprintf(fp, "Product #%d\t%d\t%d\t%d\n", (i + 1), product_sales[i][0], product_sales[i][1], product_sales[i][2]);
+    //The header is only written into a new file, so the results of many runs can be collected in one file.
+    if(ftell(fp) == 0){
+        fprintf(fp, "customers,sellers,products,days,mode,threads,dispatch,wait,seconds,operations,buy,reserve,cancel,");
+        fprintf(fp, "ops_per_sec,buy_per_sec,reserve_per_sec,cancel_per_sec,seed,alignment\n");
     }
 
-    ////////////////////////////////////////////////////////
+    fprintf(fp, "%d,%d,%d,%d,%s,%d,%s,%s,", number_of_customers, number_of_sellers, number_of_products, number_of_simulation_days,
+            pool_mode ? "pool" : "threads", threads, dispatch_name[dispatch_mode], wait_name[wait_mode]);
+    fprintf(fp, "%.6f,%lld,%lld,%lld,%lld,", seconds, operations, transaction_of_operation[0], transaction_of_operation[1], transaction_of_operation[2]);
+    fprintf(fp, "%.1f,%.1f,%.1f,%.1f,%llu,%d\n", operations / seconds, transaction_of_operation[0] / seconds, transaction_of_operation[1] / seconds,
+            transaction_of_operation[2] / seconds, (unsigned long long) random_seed, CACHE_LINE_SIZE);
 
     fclose(fp);
 }
 
 void clean_up(){
 
-    int i;
-
-    free(num_of_instances_of_product);
+    free_interleaved(products, number_of_products * sizeof(product_struct));
 
-    for(i = 0; i < number_of_customers; i++) free(customer_information[i]);
-    free(customer_information);
-
-    for(i = 0; i < number_of_products; i++) free(product_sales[i]);
-    free(product_sales);
+    free_day_bank(&day_banks[0]);
+    free_day_bank(&day_banks[1]);
 
     free(customer_ids);
     free(seller_ids);
-    free(seller_mutex);
-    free(customers);
-    free(customer_status);
-    free(seller_to_customer);
-    free(product_mutex);
-    free(current_day_initialized);
-
-    clean_reserve_list();
-    clean_transaction_list();
-}
+    free_interleaved(customers, number_of_customers * sizeof(customer_struct));
+    free_interleaved(baskets, (size_t) number_of_customers * basket_capacity * sizeof(operation_struct));
+    free(customer_random);
+    free_alias_table(&workload.operations);
+    free_alias_table(&workload.products);
+    free_alias_table(&workload.amounts);
+    free(metrics);
+
+    if(metrics_file != NULL && metrics_file != stdout) fclose(metrics_file);
+    free_interleaved(customer_reply, number_of_customers * sizeof(wait_word));
+    free(request_queue.cells);
+    free(parked_queue.cells);
+    free(worker_ids);
+    free(transaction_of_customer);
+    free(transaction_of_seller);
 
-void clean_reserve_list(){
+    clean_transaction_list();
 
-    reserve_struct *reserve_current = reserve;
-    reserve_struct *reserve_to_delete;
+    if(trace_records != NULL) free_trace();
 
-    while(reserve_current != NULL){
-        reserve_to_delete = reserve_current;
-        reserve_current = reserve_current->next;
+    free(initial_num_of_instances);
+    free(initial_customer_rights);
+    free(initial_customer_reserve_left);
+}
 
-        free(reserve_to_delete);
-    }
+void clean_reserve_list_of(day_bank_struct *bank, int customer_no){
 
-    reserve = NULL;
+    //The reservations themselves belong to the slabs of the sellers, which are reset or unmapped as a whole.
+    bank->reserve[customer_no].head = NULL;
+    bank->reserve[customer_no].tail = NULL;
 }
 
 void clean_transaction_list(){
 
-    transaction_struct *transaction_current = transaction;
-    transaction_struct *transaction_to_delete;
+    transaction_arena *arena_current;
+    transaction_arena *arena_to_delete;
 
-    while(transaction_current != NULL){
-        transaction_to_delete = transaction_current;
-        transaction_current = transaction_current->next;
+    for(int i = 0; i < number_of_sellers; i++){
 
-        free(transaction_to_delete);
+        free(sellers[i].shard.operations);
+        free(sellers[i].shard.successful);
+
+        free_reserve_slab(&sellers[i].slab[0]);
+        free_reserve_slab(&sellers[i].slab[1]);
+
+        if(escrow_batch > 0){
+            munmap(sellers[i].escrow[0], number_of_products * sizeof(escrow_struct));
+            munmap(sellers[i].escrow[1], number_of_products * sizeof(escrow_struct));
+        }
+
+        //Every chunk of the log is in one of the arenas, whether it was written or not.
+        arena_current = sellers[i].log.arena;
+
+        while(arena_current != NULL){
+            arena_to_delete = arena_current;
+            arena_current = arena_current->next;
+
+            munmap(arena_to_delete, sizeof(transaction_arena));
+        }
     }
+
+    free(sellers);
 }
 //</editor-fold>